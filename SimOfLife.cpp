@@ -26,6 +26,8 @@
 #include <fstream> // ifstream
 #include <string> // getline
 #include <cassert> // assert
+#include <vector> // active tile list
+#include <algorithm> // min, max
 
 #ifdef __GNUC__
 #include <cstring> // memcpy for g++
@@ -42,6 +44,14 @@
 #include "seqMode.h" // sequential implementation
 #include "ompMode.h" // openMP implementation
 #include "oclMode.h" // openCL implementation
+#include "bitsMode.h" // bit packed openMP implementation
+#include "simdMode.h" // explicit vectorized openMP implementation
+#include "lutMode.h" // 4x4 -> 2x2 lookup table openMP implementation
+#include "hashlifeMode.h" // quadtree implementation for long runs
+#include "sparseMode.h" // live cell hash table implementation for sparse boards
+#include "distMode.h" // band decomposition over several processes
+#include "batch.h" // many boards in one process
+#include "bench.h" // benchmark of all engines on generated boards
 
 int main(int argc, char** argv)
 {
@@ -52,10 +62,34 @@ int main(int argc, char** argv)
     std::string path("out" + std::to_string(generations) + ".out");
     const char* fileO = path.c_str();           // --save - filename with the extension .gol
     bool printMeasure = true;                   // --mesaure - generates measurement output on stdout
-    std::string mode = "seq";                   // --mode - seq, omp, ocl
+    compressSnapshots = false;                  // --compress - rle compress .golb output
+    checkpointEvery = 0;                        // --checkpoint-every - write a checkpoint every N generations, 0 = off
+    checkpointDir = ".";                        // --checkpoint-dir - folder for checkpoints
+    resumeCheckpoint = false;                   // --resume - continue from the latest checkpoint
+    emitEvery = 0;                              // --emit-every - append every N-th generation to the frame stream, 0 = off
+    emitFile = "frames.golf";                   // --emit - filename of the frame stream
+    cycleDetect = false;                        // --cycles - skip ahead once the board repeats (seq, omp, bits, simd, lut)
+    std::string ruleText = "B3/S23";            // --rule - life-like rule in B/S notation, see rule.h
+    int extractFrame = -1;                      // --extract-frame - save frame k of the frame stream instead of running
+    const char* batchFile = 0;                  // --batch - manifest of jobs to run in this process
+    std::string profileFile;                    // --profile - write timing statistics as .csv or .json
+    std::string traceFile;                      // --trace - write timed scopes in chrome trace format
+    bool bench = false;                         // --bench - benchmark all engines instead of running (options --bench-*)
+    std::string mode = "seq";                   // --mode - seq, omp, ocl, bits, simd, lut, hashlife, sparse, auto, dist
     int threads = 8;                            // --threads - amount of threads to use for omp
+    std::string simd = "auto";                  // --simd - auto, scalar, sse2, avx2, avx512
+    int tileSize = 0;                           // --tiles - tile size for activity tracking in omp, 0 = off
+    int blockGens = 0;                          // --time-block - generations per temporal block in omp, 0 = off
+    bool numa = false;                          // --numa - first touch row bands per thread in omp
+    std::string affinity = "none";              // --affinity - none, compact, spread pinning of the omp threads
+    size_t hashlifeMem = 1024;                  // --hashlife-mem - node memory limit in MB for hashlife
+    int ranks = 2;                              // --ranks - worker processes for dist
+    std::string transport = "shm";              // --transport - shm, tcp for dist
+    unsigned int halo = 1;                      // --halo - halo rows and generations per exchange for dist
     int platformId = 0;                         // --platformId - platform to use for ocl
     int deviceId = 0;                           // --deviceId - device to use for ocl
+    std::string oclKernel = "plain";            // --ocl-kernel - plain or tiled kernel for ocl
+    unsigned int oclBlock = 1;                  // --ocl-block - generations per launch of the tiled kernel
     debugOutput = false;                        // --debug
     for (int i = 0; i < argc; ++i)
     {
@@ -69,6 +103,15 @@ int main(int argc, char** argv)
             else if (strcmp(argv[i], "--measure") == 0) printMeasure = true;
             else if (strcmp(argv[i], "--mode") == 0) mode = argv[i + 1];
             else if (strcmp(argv[i], "--threads") == 0) threads = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--simd") == 0) simd = argv[i + 1];
+            else if (strcmp(argv[i], "--tiles") == 0) tileSize = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--time-block") == 0) blockGens = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--numa") == 0) numa = true;
+            else if (strcmp(argv[i], "--affinity") == 0) affinity = argv[i + 1];
+            else if (strcmp(argv[i], "--hashlife-mem") == 0) hashlifeMem = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--ranks") == 0) ranks = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--transport") == 0) transport = argv[i + 1];
+            else if (strcmp(argv[i], "--halo") == 0) halo = std::stoul(argv[i + 1]);
             else if (strcmp(argv[i], "--device") == 0) // automatically selects platform & device -> handle as default
             {
                 if (strcmp(argv[i + 1], "gpu") == 0) platformId = 0;
@@ -76,24 +119,106 @@ int main(int argc, char** argv)
             }
             else if (strcmp(argv[i], "--platformId") == 0) platformId = std::stoi(argv[i + 1]);
             else if (strcmp(argv[i], "--deviceId") == 0) deviceId = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--ocl-kernel") == 0) oclKernel = argv[i + 1];
+            else if (strcmp(argv[i], "--ocl-block") == 0) oclBlock = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--ocl-cache") == 0) oclCacheDir = argv[i + 1];
             else if (strcmp(argv[i], "--debug") == 0) debugOutput = true;
+            else if (strcmp(argv[i], "--compress") == 0) compressSnapshots = true;
+            else if (strcmp(argv[i], "--checkpoint-every") == 0) checkpointEvery = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--checkpoint-dir") == 0) checkpointDir = argv[i + 1];
+            else if (strcmp(argv[i], "--resume") == 0) resumeCheckpoint = true;
+            else if (strcmp(argv[i], "--emit-every") == 0) emitEvery = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--emit") == 0) emitFile = argv[i + 1];
+            else if (strcmp(argv[i], "--cycles") == 0) cycleDetect = true;
+            else if (strcmp(argv[i], "--rule") == 0) ruleText = argv[i + 1];
+            else if (strcmp(argv[i], "--extract-frame") == 0) extractFrame = std::stoi(argv[i + 1]);
+            else if (strcmp(argv[i], "--batch") == 0) batchFile = argv[i + 1];
+            else if (strcmp(argv[i], "--profile") == 0) profileFile = argv[i + 1];
+            else if (strcmp(argv[i], "--trace") == 0) traceFile = argv[i + 1];
+            else if (strcmp(argv[i], "--bench") == 0) bench = true;
+            else if (strcmp(argv[i], "--bench-sizes") == 0) benchConfig.sizes = benchList<unsigned int>(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-densities") == 0) benchConfig.densities = benchList<double>(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-threads") == 0) benchConfig.threads = benchList<int>(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-engines") == 0) benchConfig.engines = benchList<std::string>(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-seed") == 0) benchConfig.seed = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-warmup") == 0) benchConfig.warmup = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-reps") == 0) benchConfig.repetitions = std::stoul(argv[i + 1]);
+            else if (strcmp(argv[i], "--bench-out") == 0) benchConfig.output = argv[i + 1];
         }
     }
+    if (!parseRule(ruleText, rule))
+    {
+        std::cerr << "invalid rule " << ruleText << ", expected B/S notation like B3/S23" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!profileFile.empty() || !traceFile.empty()) Timing::getInstance()->enableScopes(true);
+
+    // runs one board, for the whole program, every job of a batch or every bench run
+    auto run = [&](const std::string& runMode, const char* in, const char* out, unsigned int gens, int runThreads)
+    {
+        if (runMode == "default" || runMode == "seq")
+        {
+            runSeq(in, out, gens);
+        }
+        else if (runMode == "omp")
+        {
+            runOMP(in, out, gens, runThreads, tileSize, blockGens, numa, affinity);
+        }
+        else if (runMode == "ocl")
+        {
+            runOCL(in, out, gens, platformId, deviceId, oclKernel, oclBlock);
+        }
+        else if (runMode == "bits")
+        {
+            runBits(in, out, gens, runThreads);
+        }
+        else if (runMode == "simd")
+        {
+            runSIMD(in, out, gens, runThreads, simd);
+        }
+        else if (runMode == "lut")
+        {
+            runLUT(in, out, gens, runThreads);
+        }
+        else if (runMode == "hashlife")
+        {
+            runHashLife(in, out, gens, hashlifeMem);
+        }
+        else if (runMode == "sparse" || runMode == "auto")
+        {
+            runSparse(in, out, gens, runThreads, runMode == "auto");
+        }
+        else if (runMode == "dist")
+        {
+            runDist(in, out, gens, runThreads, ranks, transport, halo);
+        }
+    };
 
-    if (mode == "default" || mode == "seq")
+    if (extractFrame >= 0)
     {
-        runSeq(fileI, fileO, generations);
+        runExtractFrame(emitFile.c_str(), extractFrame, fileO);
     }
-    else if (mode == "omp")
+    else if (batchFile != 0)
     {
-        runOMP(fileI, fileO, generations, threads);
+        runBatch(batchFile, [&](const BatchJob& job) { run(job.mode, job.input.c_str(), job.output.c_str(), job.generations, threads); });
+        printMeasure = false; // printed after every job
     }
-    else if (mode == "ocl")
+    else if (bench)
     {
-        runOCL(fileI, fileO, generations, platformId, deviceId);
+        oclKeepResult = true; // the checksum is taken from cells
+        runBench(benchConfig, generations, oclAvailable(platformId), run);
+        printMeasure = false;
     }
+    else run(mode, fileI, fileO, generations, threads);
 
     if (debugOutput) Timing::getInstance()->print();
+    if (!profileFile.empty())
+    {
+        bool json = profileFile.size() >= 5 && profileFile.compare(profileFile.size() - 5, 5, ".json") == 0;
+        bool written = json ? Timing::getInstance()->exportJSON(profileFile) : Timing::getInstance()->exportCSV(profileFile);
+        if (!written) std::cerr << "error writing " << profileFile << std::endl;
+    }
+    if (!traceFile.empty() && !Timing::getInstance()->exportTrace(traceFile)) std::cerr << "error writing " << traceFile << std::endl;
     if (printMeasure) std::cout << Timing::getInstance()->getResults() << std::endl;
 
     return EXIT_SUCCESS;
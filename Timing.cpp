@@ -1,27 +1,36 @@
 #include <stdio.h>
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include "Timing.h"
 
 Timing* Timing::mInstance = 0;
+std::atomic<bool> Timing::sEnabled{ false };
+const std::chrono::high_resolution_clock::time_point Timing::sEpoch = std::chrono::high_resolution_clock::now();
 
 /**
  * Singleton: Get instance.
+ * Created once, also if the first calls come from several threads.
  */
 Timing* Timing::getInstance() {
-	if (mInstance == 0) {
-		mInstance = new Timing();
-	}
+	static Timing* instance = mInstance = new Timing();
 
-	return mInstance;
+	return instance;
 }
 
 /**
  * Start recording time with any name.
  */
 void Timing::startRecord(const std::string& name) {
+	if (sEnabled.load(std::memory_order_relaxed)) {
+		beginScope(intern(name));
+	}
 	auto start = std::chrono::high_resolution_clock::now();
 
+	std::lock_guard<std::mutex> lock(mMutex);
 	auto it = mRecordings.find(name);
 	if (it != mRecordings.end()) {
 		it->second = start;
@@ -33,18 +42,300 @@ void Timing::startRecord(const std::string& name) {
 
 /**
  * Stop recording time with any name.
+ * A repeated record overwrites the previous result.
  */
 void Timing::stopRecord(const std::string& name) {
 	auto end = std::chrono::high_resolution_clock::now();
+	if (sEnabled.load(std::memory_order_relaxed)) {
+		// only close the scope opened by the matching startRecord
+		ThreadBuffer* buffer = threadBuffer();
+		unsigned int id = intern(name);
+		if (buffer->depth > 0 && buffer->depth <= TIMING_MAX_DEPTH && buffer->stack[buffer->depth - 1].id == id) {
+			endScope();
+		}
+	}
 
+	std::lock_guard<std::mutex> lock(mMutex);
 	auto it = mRecordings.find(name);
 	if (it != mRecordings.end()) {
 		auto start = it->second;
 		auto result = end - start;
 
-		mResults.insert(std::pair<std::string, std::chrono::duration<double, std::milli> >(name, result));
+		mResults[name] = result;
+	}
+
+}
+
+/**
+ * Add a sample to a named series of values (e.g. a count per generation).
+ */
+void Timing::addValue(const std::string& name, double value) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mValues[name].push_back(value);
+}
+
+/**
+ * Get all samples of a named series, empty if nothing was added.
+ */
+const std::vector<double>& Timing::getValues(const std::string& name) const {
+	static const std::vector<double> empty;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto it = mValues.find(name);
+	if (it != mValues.end()) {
+		return it->second;
+	}
+
+	return empty;
+}
+
+/**
+ * Get the result of a record in ms, 0 if it was not recorded.
+ */
+double Timing::getRecord(const std::string& name) const {
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto it = mResults.find(name);
+	if (it != mResults.end()) {
+		return it->second.count();
 	}
 
+	return 0;
+}
+
+/**
+ * Forget all recordings, results, values and scopes (e.g. between the jobs of a batch).
+ * No scope may be open on another thread meanwhile.
+ */
+void Timing::reset() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mRecordings.clear();
+	mResults.clear();
+	mValues.clear();
+	mEvents.clear();
+	mDropped = 0;
+	for (auto& buffer : mBuffers) {
+		buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+		buffer->dropped.store(0, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * Start the next run of a batch or bench: forget recordings and results, so setup,
+ * computation and finalization are the ones of this run. While scopes are enabled
+ * values and scopes are kept, so --profile / --trace export all runs.
+ */
+void Timing::resetRun() {
+	if (!sEnabled.load(std::memory_order_relaxed)) {
+		reset();
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mRecordings.clear();
+	mResults.clear();
+}
+
+/**
+ * Get the id of a scope name, the same name always gets the same id.
+ */
+unsigned int Timing::intern(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	auto it = mIds.find(name);
+	if (it != mIds.end()) {
+		return it->second;
+	}
+
+	unsigned int id = (unsigned int)mNames.size();
+	mIds[name] = id;
+	mNames.push_back(name);
+	return id;
+}
+
+/**
+ * Record scopes from now on (or stop to). Records started before are also kept as scopes.
+ */
+void Timing::enableScopes(bool enabled) {
+	sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * Give the calling thread its ring buffer, called once per thread.
+ */
+Timing::ThreadBuffer* Timing::registerThread() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mBuffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+	mBuffers.back()->thread = (unsigned int)mBuffers.size() - 1;
+	return mBuffers.back().get();
+}
+
+/**
+ * Move the finished scopes of all threads out of their ring buffers.
+ * Threads keep recording meanwhile, the ring buffers are single producer / single consumer,
+ * the consumer being whoever holds the lock (also a thread whose buffer is full).
+ */
+void Timing::collect() const {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mDropped = 0;
+	for (auto& buffer : mBuffers) {
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		for (uint64_t i = buffer->tail.load(std::memory_order_relaxed); i < head; i++) {
+			mEvents.push_back(std::make_pair(buffer->thread, buffer->events[i % TIMING_RING_SIZE]));
+		}
+		buffer->tail.store(head, std::memory_order_release);
+		mDropped += buffer->dropped.load(std::memory_order_relaxed);
+	}
+}
+
+/**
+ * Name of a scope including its parent scope: parent/name.
+ */
+std::string Timing::scopeName(const Event& event) const {
+	if (event.parent == TIMING_NO_SCOPE) {
+		return mNames[event.id];
+	}
+
+	return mNames[event.parent] + "/" + mNames[event.id];
+}
+
+/**
+ * Durations in ms of all collected scopes, by name.
+ */
+std::map<std::string, std::vector<double> > Timing::scopeSamples() const {
+	collect();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::map<std::string, std::vector<double> > samples;
+	for (auto& event : mEvents) {
+		samples[scopeName(event.second)].push_back((event.second.end - event.second.start) * 1e-6);
+	}
+
+	return samples;
+}
+
+/**
+ * Aggregate a series, percentiles by nearest rank.
+ */
+Timing::Stats Timing::summarize(std::vector<double> samples) {
+	Stats stats = { samples.size(), 0, 0, 0, 0, 0, 0 };
+	if (samples.empty()) {
+		return stats;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0;
+	for (double sample : samples) {
+		sum += sample;
+	}
+	auto rank = [&samples](double p) {
+		size_t index = (size_t)std::ceil(p * samples.size());
+		return samples[index > 0 ? index - 1 : 0];
+	};
+
+	stats.min = samples.front();
+	stats.max = samples.back();
+	stats.mean = sum / samples.size();
+	stats.p50 = rank(0.5);
+	stats.p90 = rank(0.9);
+	stats.p99 = rank(0.99);
+	return stats;
+}
+
+/**
+ * Quote a name for json output.
+ */
+static std::string jsonString(const std::string& text) {
+	std::string quoted = "\"";
+	for (char c : text) {
+		if (c == '"' || c == '\\') quoted += '\\';
+		quoted += c;
+	}
+
+	return quoted + "\"";
+}
+
+/**
+ * Write records, scopes and values as csv, durations in ms:
+ * kind,name,count,min,max,mean,p50,p90,p99
+ * The last row counts the dropped scopes: dropped,"scopes",<count>,0,0,0,0,0,0
+ */
+bool Timing::exportCSV(const std::string& filePath) {
+	std::map<std::string, std::vector<double> > scopes = scopeSamples();
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::ofstream file(filePath);
+	file << "kind,name,count,min,max,mean,p50,p90,p99" << std::endl;
+
+	auto row = [&file](const char* kind, const std::string& name, const Stats& stats) {
+		file << kind << ",\"" << name << "\"," << stats.count << "," << stats.min << "," << stats.max << "," << stats.mean
+			<< "," << stats.p50 << "," << stats.p90 << "," << stats.p99 << std::endl;
+	};
+	for (auto& result : mResults) {
+		row("record", result.first, summarize({ result.second.count() }));
+	}
+	for (auto& scope : scopes) {
+		row("scope", scope.first, summarize(scope.second));
+	}
+	for (auto& values : mValues) {
+		row("value", values.first, summarize(values.second));
+	}
+	file << "dropped,\"scopes\"," << mDropped << ",0,0,0,0,0,0" << std::endl;
+
+	return (bool)file;
+}
+
+/**
+ * Write records, scopes and values as json object, durations in ms.
+ */
+bool Timing::exportJSON(const std::string& filePath) {
+	std::map<std::string, std::vector<double> > scopes = scopeSamples();
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::ofstream file(filePath);
+
+	auto series = [&file](const std::map<std::string, std::vector<double> >& all) {
+		bool first = true;
+		for (auto& entry : all) {
+			Stats stats = summarize(entry.second);
+			file << (first ? "\n" : ",\n") << "    { \"name\": " << jsonString(entry.first) << ", \"count\": " << stats.count
+				<< ", \"min\": " << stats.min << ", \"max\": " << stats.max << ", \"mean\": " << stats.mean
+				<< ", \"p50\": " << stats.p50 << ", \"p90\": " << stats.p90 << ", \"p99\": " << stats.p99 << " }";
+			first = false;
+		}
+	};
+
+	file << "{\n  \"records\": {";
+	bool first = true;
+	for (auto& result : mResults) {
+		file << (first ? "\n" : ",\n") << "    " << jsonString(result.first) << ": " << result.second.count();
+		first = false;
+	}
+	file << "\n  },\n  \"scopes\": [";
+	series(scopes);
+	file << "\n  ],\n  \"values\": [";
+	series(mValues);
+	file << "\n  ],\n  \"dropped\": " << mDropped << "\n}" << std::endl;
+
+	return (bool)file;
+}
+
+/**
+ * Write all collected scopes in the chrome trace event format (chrome://tracing, perfetto),
+ * one track per thread.
+ */
+bool Timing::exportTrace(const std::string& filePath) {
+	collect();
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::ofstream file(filePath);
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool first = true;
+	for (auto& event : mEvents) {
+		file << (first ? "\n" : ",\n") << "{\"name\": " << jsonString(mNames[event.second.id]) << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.first
+			<< ", \"ts\": " << event.second.start / 1000.0 << ", \"dur\": " << (event.second.end - event.second.start) / 1000.0 << "}";
+		first = false;
+	}
+	file << "\n]}" << std::endl;
+
+	return (bool)file;
 }
 
 /**
@@ -52,6 +343,8 @@ void Timing::stopRecord(const std::string& name) {
  * Set prettyPrint to true to display mm:ss.ms instead of ms.
  */
 void Timing::print(const bool prettyPrint) const {
+	std::map<std::string, std::vector<double> > scopes = scopeSamples();
+	std::lock_guard<std::mutex> lock(mMutex);
 	std::cout << "-----" << std::endl << "Results: " << std::endl << "-----" << std::endl;
 
 	auto it = mResults.begin();
@@ -64,6 +357,22 @@ void Timing::print(const bool prettyPrint) const {
 		it++;
 	}
 
+	auto printStats = [](const std::string& name, const Stats& stats, const char* unit) {
+		std::cout << name << ": count " << stats.count << ", min " << stats.min << unit << ", max " << stats.max << unit
+			<< ", mean " << stats.mean << unit << ", p50 " << stats.p50 << unit << ", p90 " << stats.p90 << unit
+			<< ", p99 " << stats.p99 << unit << std::endl;
+	};
+	for (auto& values : mValues) {
+		if (values.second.empty()) continue;
+		printStats(values.first, summarize(values.second), "");
+	}
+	for (auto& scope : scopes) {
+		printStats(scope.first, summarize(scope.second), "ms");
+	}
+	if (mDropped > 0) {
+		std::cout << "scopes dropped (nested deeper than " << TIMING_MAX_DEPTH << "): " << mDropped << std::endl;
+	}
+
 	std::cout << "-----" << std::endl;
 }
 
@@ -100,6 +409,7 @@ std::string Timing::parseDate(const int ms) const {
  * mm:ss.ms;mm:ss.ms;mm.ss.ms
  */
 std::string Timing::getResults() const {
+	std::lock_guard<std::mutex> lock(mMutex);
 	std::ostringstream stringStream;
 
 	auto start = mResults.find("setup");
@@ -113,7 +423,7 @@ std::string Timing::getResults() const {
 	}
 
 	auto finalization = mResults.find("finalization");
-	if (start != mResults.end()) {
+	if (finalization != mResults.end()) {
 		stringStream << parseDate((int) finalization->second.count());
 	}
 
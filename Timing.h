@@ -2,13 +2,89 @@
 #include <chrono>
 #include <string>
 #include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#define TIMING_RING_SIZE (1 << 16)	// scope events buffered per thread, a full buffer is collected by its thread
+#define TIMING_MAX_DEPTH 32			// nesting of scopes per thread, deeper ones are dropped
+#define TIMING_NO_SCOPE 0xFFFFFFFFu	// parent of a top level scope
+
+#define TIMING_CONCAT_(a, b) a##b
+#define TIMING_CONCAT(a, b) TIMING_CONCAT_(a, b)
+
+// times the rest of the enclosing block as a named scope, the name is interned once per call site
+#define TIMING_SCOPE(name) \
+	static const unsigned int TIMING_CONCAT(timingId_, __LINE__) = Timing::getInstance()->intern(name); \
+	Timing::Scope TIMING_CONCAT(timingScope_, __LINE__)(TIMING_CONCAT(timingId_, __LINE__))
 
 /**
  * Measure high precision time intervals (using std::chrono).
  * Author: Karl Hofer <hoferk@technikum-wien.at>
+ *
+ * Scopes (TIMING_SCOPE) are cheap enough for hot loops: every thread writes
+ * its events into its own lock-free ring buffer. When a buffer is full its
+ * thread collects the buffers of all threads, otherwise they are collected
+ * when results are printed or exported, so no scope is lost in long runs.
+ * Only scopes nested deeper than TIMING_MAX_DEPTH are dropped (and counted).
+ * Scopes are only recorded while enabled (--profile / --trace), otherwise
+ * they cost one branch.
  */
 class Timing {
 public:
+	// one finished scope, times in ns since the Timing instance was created
+	struct Event {
+		uint64_t start;
+		uint64_t end;
+		uint32_t id;
+		uint32_t parent;
+	};
+
+	// count, min, max, mean and percentiles of a series (nearest rank)
+	struct Stats {
+		size_t count;
+		double min;
+		double max;
+		double mean;
+		double p50;
+		double p90;
+		double p99;
+	};
+
+	// events of one thread, only the owning thread writes head and the stack
+	struct ThreadBuffer {
+		struct Frame {
+			uint32_t id;
+			uint64_t start;
+		};
+
+		std::vector<Event> events = std::vector<Event>(TIMING_RING_SIZE);
+		std::atomic<uint64_t> head{ 0 };
+		std::atomic<uint64_t> tail{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+		Frame stack[TIMING_MAX_DEPTH];
+		unsigned int depth = 0;
+		unsigned int thread = 0;
+	};
+
+	// records the lifetime of the object as scope id on the calling thread
+	class Scope {
+	public:
+		explicit Scope(unsigned int id) : mActive(Timing::sEnabled.load(std::memory_order_relaxed)) {
+			if (mActive) Timing::beginScope(id);
+		}
+		~Scope() {
+			if (mActive) Timing::endScope();
+		}
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		bool mActive;
+	};
+
 	static Timing* getInstance();
 
 	void startSetup();
@@ -20,14 +96,74 @@ public:
 
 	void startRecord(const std::string& name);
 	void stopRecord(const std::string& name);
+	void addValue(const std::string& name, double value);
+	const std::vector<double>& getValues(const std::string& name) const;
+	double getRecord(const std::string& name) const;
+	void reset();
+	void resetRun();
 	void print(const bool prettyPrint = false) const;
 	std::string getResults() const;
 
+	unsigned int intern(const std::string& name);
+	void enableScopes(bool enabled);
+	void collect() const;
+	bool exportCSV(const std::string& filePath);
+	bool exportJSON(const std::string& filePath);
+	bool exportTrace(const std::string& filePath);
+
+	static Stats summarize(std::vector<double> samples);
+	static inline uint64_t now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - sEpoch).count();
+	}
+	static inline void beginScope(unsigned int id) {
+		ThreadBuffer* buffer = threadBuffer();
+		if (buffer->depth < TIMING_MAX_DEPTH) buffer->stack[buffer->depth] = { id, now() };
+		buffer->depth++;
+	}
+	static inline void endScope() {
+		ThreadBuffer* buffer = threadBuffer();
+		if (buffer->depth == 0) return;
+		buffer->depth--;
+		if (buffer->depth >= TIMING_MAX_DEPTH) {
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		const ThreadBuffer::Frame& frame = buffer->stack[buffer->depth];
+		uint32_t parent = (buffer->depth > 0) ? buffer->stack[buffer->depth - 1].id : TIMING_NO_SCOPE;
+		uint64_t head = buffer->head.load(std::memory_order_relaxed);
+		if (head - buffer->tail.load(std::memory_order_acquire) >= TIMING_RING_SIZE) {
+			// rare, the lock is taken once per TIMING_RING_SIZE events at most
+			getInstance()->collect();
+		}
+		buffer->events[head % TIMING_RING_SIZE] = { frame.start, now(), frame.id, parent };
+		buffer->head.store(head + 1, std::memory_order_release);
+	}
+
 private:
 	Timing() {};
 	std::map<std::string, std::chrono::high_resolution_clock::time_point > mRecordings;
 	std::map<std::string, std::chrono::duration<double, std::milli> > mResults;
+	std::map<std::string, std::vector<double> > mValues;
 	std::string parseDate(const int ms) const;
 
+	static inline ThreadBuffer* threadBuffer() {
+		if (tBuffer == 0) tBuffer = getInstance()->registerThread();
+		return tBuffer;
+	}
+	ThreadBuffer* registerThread();
+	std::string scopeName(const Event& event) const;
+	std::map<std::string, std::vector<double> > scopeSamples() const;
+
+	mutable std::mutex mMutex;
+	std::map<std::string, unsigned int> mIds;
+	std::vector<std::string> mNames;
+	std::vector<std::unique_ptr<ThreadBuffer> > mBuffers;
+	mutable std::vector<std::pair<unsigned int, Event> > mEvents; // collected, with the thread index
+	mutable uint64_t mDropped = 0;
+
+	static std::atomic<bool> sEnabled;
+	static inline thread_local ThreadBuffer* tBuffer = 0;
+	static const std::chrono::high_resolution_clock::time_point sEpoch;
 	static Timing* mInstance;
 };
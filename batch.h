@@ -0,0 +1,144 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+batch:
+--batch <manifest> runs many boards in one process instead of starting the
+program once per board (see run_multiple.sh). every line of the manifest is
+one job, empty lines and lines starting with # are skipped:
+
+    <input> <output> <mode> <generations>
+
+all other options (--threads, --platformId, ...) apply to every job. being
+one process the OpenMP threads and the OpenCL context, program and queue are
+created once and reused by all jobs. the board of the next job is loaded
+(parsed and converted into the layout of its mode) on a separate thread while
+the current one runs, so its setup only takes the board over; an input that
+is the output of an earlier job is loaded by the job itself. the output is
+written by the BoardWriter thread (boardIO.h) while the next jobs are already
+loaded and calculated, so finalization only measures handing the board over.
+
+after each job one line in the format of Timing::getResults() is printed.
+with --profile / --trace the scopes and values of all jobs are exported.
+dist mode can not be used in a batch, it forks and the forked ranks must not
+inherit running threads.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+
+#include <functional>
+#include <sstream>
+
+struct BatchJob
+{
+    std::string input;
+    std::string output;
+    std::string mode;
+    unsigned int generations;
+};
+
+// reads the manifest, returns false and reports the line if it is malformed
+bool readManifest(const char* filePath, std::vector<BatchJob>& jobs)
+{
+    std::ifstream file(filePath);
+    if (!file)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++)
+    {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t") == std::string::npos) continue;
+
+        std::istringstream fields(line);
+        BatchJob job;
+        std::string rest;
+        if (!(fields >> job.input >> job.output >> job.mode >> job.generations) || (fields >> rest))
+        {
+            std::cerr << "error reading " << filePath << ": line " << number << " is not \"<input> <output> <mode> <generations>\"" << std::endl;
+            return false;
+        }
+        if (job.mode == "dist")
+        {
+            std::cerr << "error reading " << filePath << ": line " << number << ", dist mode can not be used in a batch" << std::endl;
+            return false;
+        }
+        if (job.mode != "default" && job.mode != "seq" && job.mode != "omp" && job.mode != "ocl" && job.mode != "bits" &&
+            job.mode != "simd" && job.mode != "lut" && job.mode != "hashlife" && job.mode != "sparse" && job.mode != "auto")
+        {
+            std::cerr << "error reading " << filePath << ": line " << number << ", unknown mode " << job.mode
+                << ", possible values are seq, omp, ocl, bits, simd, lut, hashlife, sparse and auto" << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// layout the mode loads its board in
+GolLayout batchLayout(const std::string& mode)
+{
+    if (mode == "default" || mode == "seq") return LAYOUT_SEQ;
+    if (mode == "bits" || mode == "lut") return LAYOUT_BITS;
+    return LAYOUT_BYTES;
+}
+
+// loads the board of a job on the prefetch thread, the job's loadBoard takes it over
+void batchPreload(BatchJob job, PreloadedBoard* preloaded)
+{
+    // keep the parsing on this thread, the omp threads belong to the computation
+    omp_set_num_threads(1);
+    preloaded->path = job.input;
+    preloaded->layout = batchLayout(job.mode);
+    preloaded->loaded = readBoard(job.input.c_str(), preloaded->layout, preloaded->board);
+}
+
+// frees what a job left in the globals (the saved board belongs to the writer)
+void batchRelease()
+{
+    delete[] cells;
+    delete[] oldCells;
+    delete[] bitCells;
+    delete[] oldBitCells;
+    cells = 0;
+    oldCells = 0;
+    bitCells = 0;
+    oldBitCells = 0;
+}
+
+// runs all jobs of the manifest with run, prints one timing line per job
+void runBatch(const char* manifest, const std::function<void(const BatchJob&)>& run)
+{
+    std::vector<BatchJob> jobs;
+    if (!readManifest(manifest, jobs)) exit(EXIT_FAILURE);
+    if (debugOutput) std::cout << "batch: " << jobs.size() << " jobs" << std::endl;
+
+    boardWriter.start();
+    std::thread prefetch;
+    PreloadedBoard next = { "", LAYOUT_BYTES, false, {} };
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (prefetch.joinable()) prefetch.join();
+        preloadedBoard = next;
+        next = { "", LAYOUT_BYTES, false, {} };
+
+        // an output of this or an earlier job may not be written yet
+        bool preload = i + 1 < jobs.size();
+        for (size_t j = 0; j <= i && preload; j++) preload = jobs[j].output != jobs[i + 1].input;
+        if (preload) prefetch = std::thread(batchPreload, jobs[i + 1], &next);
+
+        Timing::getInstance()->resetRun();
+        run(jobs[i]);
+        std::cout << Timing::getInstance()->getResults() << std::endl;
+        batchRelease();
+    }
+    if (prefetch.joinable()) prefetch.join();
+    PreloadedBoard unused;
+    takePreloaded("", LAYOUT_BYTES, unused);
+
+    if (!boardWriter.finish()) exit(EXIT_FAILURE);
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+bench:
+--bench (or make bench) measures all engines on generated boards instead of
+running a single board. for every size (square boards) and density a random
+board is generated from --bench-seed and written as .golb into the temp
+folder, then every engine (omp, bits, simd and lut once per thread count) runs
+--bench-warmup unmeasured and --bench-reps measured times over --generations.
+
+only the computation time is taken (Timing "computation"), reported as median
+and standard deviation of the seconds and of the cells per second
+(width * height * generations / seconds). all engines must end with the same
+board (crc32 of the bit packed cells), a mismatch is reported in the verified
+column and ends the program with EXIT_FAILURE after the report is written.
+
+the report is csv, or json with the extension .json (--bench-out), one entry
+per size, density, engine and thread count, so two builds can be compared by
+joining on these columns.
+
+hashlife (infinite plane) and dist (forks) are not part of the bench.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+#include "batch.h" // batchRelease
+#include "omp.h"
+
+#include <functional>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <cmath>
+
+struct BenchConfig
+{
+    std::vector<unsigned int> sizes = { 256, 1024 };    // --bench-sizes
+    std::vector<double> densities = { 0.05, 0.3 };      // --bench-densities
+    std::vector<int> threads;                           // --bench-threads, empty = 1, 2, 4, ... up to omp_get_max_threads()
+    std::vector<std::string> engines;                   // --bench-engines, empty = seq, omp, bits, simd, lut, sparse (and ocl if present)
+    unsigned int seed = 1;                              // --bench-seed
+    unsigned int warmup = 1;                            // --bench-warmup
+    unsigned int repetitions = 5;                       // --bench-reps
+    std::string output;                                 // --bench-out, empty = csv on stdout
+};
+
+BenchConfig benchConfig;
+
+struct BenchResult
+{
+    unsigned int size;
+    double density;
+    std::string engine;
+    int threads;
+    double medianSeconds;
+    double stddevSeconds;
+    double medianCellsPerSecond;
+    double stddevCellsPerSecond;
+    uint32_t checksum;
+    bool verified;
+};
+
+// splits a comma separated option value, e.g. "256,1024"
+template <typename T>
+std::vector<T> benchList(const char* text)
+{
+    std::vector<T> values;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (item.empty()) continue;
+        std::istringstream field(item);
+        T value;
+        if (field >> value) values.push_back(value);
+        else std::cerr << "ignoring bench value " << item << std::endl;
+    }
+    return values;
+}
+
+// writes a random size x size board with the given density as .golb
+bool benchBoard(const std::string& filePath, unsigned int size, double density, unsigned int seed)
+{
+    setDimensions(size, size);
+    std::vector<uint64_t> bits((size_t)words_per_row * h, 0);
+    std::seed_seq sequence = { seed, size, (unsigned int)(density * 1000000) };
+    std::mt19937_64 random(sequence);
+    std::bernoulli_distribution alive(density);
+    for (unsigned int y = 0; y < h; y++)
+    {
+        uint64_t* row = bits.data() + (size_t)y * words_per_row;
+        for (unsigned int x = 0; x < w; x++)
+        {
+            if (alive(random)) row[x / 64] |= 1ull << (x % 64);
+        }
+    }
+
+    BoardView board = { w, h, words_per_row, 0, bits.data(), 0 };
+    return writeGolb(filePath.c_str(), LAYOUT_BITS, board);
+}
+
+// crc32 of the board an engine left in the globals, bit packed so all layouts compare equal
+uint32_t benchChecksum()
+{
+    std::vector<uint64_t> bits((size_t)words_per_row * h, 0);
+    if (bitCells != 0) memcpy(bits.data(), bitCells, bits.size() * sizeof(uint64_t));
+    else
+    {
+        for (unsigned int y = 0; y < h; y++)
+        {
+            const unsigned char* row = cells + (size_t)y * w;
+            uint64_t* dst = bits.data() + (size_t)y * words_per_row;
+            for (unsigned int x = 0; x < w; x++) dst[x / 64] |= (uint64_t)(row[x] & STATE_ALIVE) << (x % 64);
+        }
+    }
+    return crc32((const unsigned char*)bits.data(), bits.size() * sizeof(uint64_t));
+}
+
+double benchMedian(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    return (n % 2 == 1) ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+double benchStddev(const std::vector<double>& samples)
+{
+    if (samples.size() < 2) return 0;
+    double mean = 0;
+    for (double sample : samples) mean += sample;
+    mean /= samples.size();
+    double sum = 0;
+    for (double sample : samples) sum += (sample - mean) * (sample - mean);
+    return std::sqrt(sum / (samples.size() - 1));
+}
+
+bool benchReport(const std::vector<BenchResult>& results, unsigned int generations, const BenchConfig& config)
+{
+    std::ofstream file;
+    bool json = config.output.size() >= 5 && config.output.compare(config.output.size() - 5, 5, ".json") == 0;
+    if (!config.output.empty())
+    {
+        file.open(config.output);
+        if (!file)
+        {
+            std::cerr << "error opening " << config.output << std::endl;
+            return false;
+        }
+    }
+    std::ostream& out = config.output.empty() ? std::cout : file;
+
+    if (json) out << "{\n  \"generations\": " << generations << ",\n  \"seed\": " << config.seed << ",\n  \"repetitions\": " << config.repetitions << ",\n  \"results\": [";
+    else out << "size,density,engine,threads,generations,repetitions,median_s,stddev_s,median_cells_per_s,stddev_cells_per_s,checksum,verified" << std::endl;
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        if (json)
+        {
+            out << (i == 0 ? "\n" : ",\n") << "    { \"size\": " << r.size << ", \"density\": " << r.density << ", \"engine\": \"" << r.engine
+                << "\", \"threads\": " << r.threads << ", \"median_s\": " << r.medianSeconds << ", \"stddev_s\": " << r.stddevSeconds
+                << ", \"median_cells_per_s\": " << r.medianCellsPerSecond << ", \"stddev_cells_per_s\": " << r.stddevCellsPerSecond
+                << ", \"checksum\": " << r.checksum << ", \"verified\": " << (r.verified ? "true" : "false") << " }";
+        }
+        else
+        {
+            out << r.size << "," << r.density << "," << r.engine << "," << r.threads << "," << generations << "," << config.repetitions << ","
+                << r.medianSeconds << "," << r.stddevSeconds << "," << r.medianCellsPerSecond << "," << r.stddevCellsPerSecond << ","
+                << r.checksum << "," << (r.verified ? 1 : 0) << std::endl;
+        }
+    }
+    if (json) out << "\n  ]\n}" << std::endl;
+    return (bool)out;
+}
+
+// runs the bench, run(mode, fileI, fileO, generations, threads) runs one engine like main does
+void runBench(const BenchConfig& config, unsigned int generations, bool oclPresent,
+    const std::function<void(const std::string&, const char*, const char*, unsigned int, int)>& run)
+{
+    std::vector<std::string> engines = config.engines;
+    if (engines.empty())
+    {
+        engines = { "seq", "omp", "bits", "simd", "lut", "sparse" };
+        if (oclPresent) engines.push_back("ocl");
+    }
+    std::vector<int> threadCounts = config.threads;
+    if (threadCounts.empty())
+    {
+        for (int t = 1; t < omp_get_max_threads(); t *= 2) threadCounts.push_back(t);
+        threadCounts.push_back(omp_get_max_threads());
+    }
+    for (const std::string& engine : engines)
+    {
+        if (engine != "seq" && engine != "omp" && engine != "ocl" && engine != "bits" && engine != "simd" && engine != "lut" && engine != "sparse")
+        {
+            std::cerr << "engine " << engine << " can not be benched, possible values are seq, omp, ocl, bits, simd, lut, sparse" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (config.repetitions == 0)
+    {
+        std::cerr << "--bench-reps must be at least 1" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::error_code error;
+    std::filesystem::path folder = std::filesystem::temp_directory_path(error) / "simoflife_bench";
+    std::filesystem::create_directories(folder, error);
+    std::string boardPath = (folder / "board.golb").string();
+    std::string outPath = (folder / "out.golb").string();
+
+    std::vector<BenchResult> results;
+    bool allVerified = true;
+    for (unsigned int size : config.sizes)
+    {
+        for (double density : config.densities)
+        {
+            if (!benchBoard(boardPath, size, density, config.seed)) exit(EXIT_FAILURE);
+            bool first = true;
+            uint32_t reference = 0;
+
+            for (const std::string& engine : engines)
+            {
+                bool threaded = (engine == "omp" || engine == "bits" || engine == "simd" || engine == "lut");
+                for (int threads : threaded ? threadCounts : std::vector<int>{ 1 })
+                {
+                    std::vector<double> seconds;
+                    std::vector<double> rates;
+                    uint32_t checksum = 0;
+                    for (unsigned int rep = 0; rep < config.warmup + config.repetitions; rep++)
+                    {
+                        Timing::getInstance()->resetRun();
+                        run(engine, boardPath.c_str(), outPath.c_str(), generations, threads);
+                        checksum = benchChecksum();
+                        batchRelease();
+                        if (rep < config.warmup) continue;
+
+                        double s = Timing::getInstance()->getRecord("computation") / 1000;
+                        seconds.push_back(s);
+                        rates.push_back(s > 0 ? (double)size * size * generations / s : 0);
+                    }
+
+                    if (first) reference = checksum;
+                    first = false;
+                    bool verified = checksum == reference;
+                    if (!verified) std::cerr << "bench: " << engine << " (" << threads << " threads) differs on size " << size << ", density " << density << std::endl;
+                    allVerified = allVerified && verified;
+
+                    double median = benchMedian(seconds);
+                    results.push_back({ size, density, engine, threads, median, benchStddev(seconds),
+                        median > 0 ? (double)size * size * generations / median : 0, benchStddev(rates), checksum, verified });
+                    if (debugOutput) std::cout << "bench: " << size << " " << density << " " << engine << " " << threads << ": " << median << " s" << std::endl;
+                }
+            }
+        }
+    }
+    std::filesystem::remove_all(folder, error);
+
+    if (!benchReport(results, generations, config) || !allVerified) exit(EXIT_FAILURE);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+bits mode:
+stores the board as one bit per cell, 64 cells per uint64_t word (see
+common.h for the layout). the next generation is computed for a whole word at
+once by bit sliced adders: the eight neighbour words (shifted left / right
+within the row, plus the rows above and below) are summed with full adders
+into three bit planes (ones, twos, fours) and the rule is evaluated on those.
+
+compared to ompMode this reads 1/8 of a byte per cell instead of 5 bytes and
+needs no extra pass to apply the rule. rows are processed in parallel, the two
+boards are swapped after each generation.
+
+toroidal wrap is the same as in the other modes: for the first word of a row
+the left neighbour is the last cell of the row, for the last word the right
+neighbour is the first cell of the row. a count of 8 neighbours wraps to 0 in
+the three planes, which is fine for conway because only 2 and 3 matter.
+other rules (--rule) match the counts of the rule against the planes: for the
+pre-instantiated ones (StaticRule) only the terms of the counts set in the
+masks are generated at compile time, and the eights plane only if 0 or 8
+neighbours matter. a rule read at runtime (DynamicRule) tests all 9 counts.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "cycle.h"
+#include "rule.h"
+#include "omp.h"
+
+// full adder on 64 cells at once: sum = a + b + c as (sum, carry)
+inline void bitsFullAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t& sum, uint64_t& carry)
+{
+    uint64_t ab = a ^ b;
+    sum = ab ^ c;
+    carry = (a & b) | (ab & c);
+}
+
+// word of left neighbours: bit i is the cell at x - 1
+inline uint64_t bitsWest(const uint64_t* row, unsigned int k, unsigned int lastWord, unsigned int lastBit)
+{
+    uint64_t carry = (k == 0) ? (row[lastWord] >> lastBit) : (row[k - 1] >> 63);
+    return (row[k] << 1) | (carry & 1);
+}
+
+// word of right neighbours: bit i is the cell at x + 1
+inline uint64_t bitsEast(const uint64_t* row, unsigned int k, unsigned int lastWord, unsigned int lastBit)
+{
+    if (k == lastWord) return (row[k] >> 1) | ((row[0] & 1) << lastBit);
+    return (row[k] >> 1) | (row[k + 1] << 63);
+}
+
+// word of the cells with exactly count neighbours, from the planes of the count
+inline uint64_t bitsCount(int count, uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights)
+{
+    return ((count & 1) ? ones : ~ones) & ((count & 2) ? twos : ~twos) &
+        ((count & 4) ? fours : ~fours) & ((count & 8) ? eights : ~eights);
+}
+
+// word of the cells with exactly Count neighbours, without the eights plane 8 counts as 0
+template <int Count, bool Eights>
+inline uint64_t bitsCount(uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights)
+{
+    // highest planes first, so the terms of neighbouring counts share their prefix
+    uint64_t match = (Count & 4) ? fours : ~fours;
+    if (Eights) match &= (Count & 8) ? eights : ~eights;
+    match &= (Count & 2) ? twos : ~twos;
+    return match & ((Count & 1) ? ones : ~ones);
+}
+
+// cells with one of the counts set in Mask, a term only for each of them
+template <uint16_t Mask, bool Eights, int... N>
+inline uint64_t bitsMatches(uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights, std::integer_sequence<int, N...>)
+{
+    return (0 | ... | (((Mask >> N) & 1) ? bitsCount<N, Eights>(ones, twos, fours, eights) : 0));
+}
+
+// next state of 64 cells by a rule known at compile time
+template <uint16_t Birth, uint16_t Survive>
+inline uint64_t bitsRule(const StaticRule<Birth, Survive>& rule, uint64_t cur, uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights)
+{
+    typedef StaticRule<Birth, Survive> R;
+    constexpr bool useEights = ((Birth | Survive) & 0x101) != 0;
+    return bitsMatches<R::both, useEights>(ones, twos, fours, eights, RuleCounts()) |
+        (cur & bitsMatches<R::surviveOnly, useEights>(ones, twos, fours, eights, RuleCounts())) |
+        (~cur & bitsMatches<R::bornOnly, useEights>(ones, twos, fours, eights, RuleCounts()));
+}
+
+// next state of 64 cells by the masks of the rule, counts in both masks do not depend on the cell
+inline uint64_t bitsRule(const DynamicRule& rule, uint64_t cur, uint64_t ones, uint64_t twos, uint64_t fours, uint64_t eights)
+{
+    uint64_t next = 0;
+    for (int count = 0; count <= 8; count++)
+    {
+        bool born = (rule.birth >> count) & 1;
+        bool survives = (rule.survive >> count) & 1;
+        if (!born && !survives) continue;
+        uint64_t match = bitsCount(count, ones, twos, fours, eights);
+        next |= (born && survives) ? match : born ? (match & ~cur) : (match & cur);
+    }
+    return next;
+}
+
+// calculates one row of the next generation into dst
+template <typename R>
+inline void bitsStepRow(const uint64_t* up, const uint64_t* cur, const uint64_t* down, uint64_t* dst,
+    unsigned int words, unsigned int lastBit, uint64_t lastMask, const R& rule)
+{
+    unsigned int lastWord = words - 1;
+    uint64_t sumTop, carryTop, sumBot, carryBot, sumMid, carryMid;
+    uint64_t ones, carryOnes, twos, carryTwos, fours;
+    for (unsigned int k = 0; k < words; k++)
+    {
+        bitsFullAdd(bitsWest(up, k, lastWord, lastBit), up[k], bitsEast(up, k, lastWord, lastBit), sumTop, carryTop);
+        bitsFullAdd(bitsWest(down, k, lastWord, lastBit), down[k], bitsEast(down, k, lastWord, lastBit), sumBot, carryBot);
+
+        uint64_t west = bitsWest(cur, k, lastWord, lastBit);
+        uint64_t east = bitsEast(cur, k, lastWord, lastBit);
+        sumMid = west ^ east;
+        carryMid = west & east;
+
+        // ones plane and carries of weight 2
+        bitsFullAdd(sumTop, sumBot, sumMid, ones, carryOnes);
+        bitsFullAdd(carryTop, carryBot, carryMid, twos, fours);
+        carryTwos = twos & carryOnes;
+        twos ^= carryOnes;
+        if (R::conway)
+        {
+            fours ^= carryTwos;
+
+            // alive with 2 or 3 neighbours, dead with 3 neighbours
+            dst[k] = twos & ~fours & (ones | cur[k]);
+        }
+        else
+        {
+            uint64_t eights = fours & carryTwos;
+            fours ^= carryTwos;
+            dst[k] = bitsRule(rule, cur[k], ones, twos, fours, eights);
+        }
+    }
+    dst[lastWord] &= lastMask;
+}
+
+template <typename R>
+void bitsGeneration(const uint64_t* src, uint64_t* dst, const R& rule)
+{
+    int height = (int)h;
+    unsigned int words = words_per_row;
+    unsigned int lastBit = col_right % 64;
+    uint64_t lastMask = (lastBit == 63) ? ~0ULL : ((1ULL << (lastBit + 1)) - 1);
+
+    int row;
+#pragma omp parallel for schedule(static)
+    for (row = 0; row < height; row++)
+    {
+        const uint64_t* up = src + ((row == 0) ? row_bot : row - 1) * words;
+        const uint64_t* down = src + ((row == row_bot) ? 0 : row + 1) * words;
+        bitsStepRow(up, src + row * words, down, dst + row * words, words, lastBit, lastMask, rule);
+    }
+}
+
+void runBits(const char* fileI, const char* fileO, unsigned int generations, int threads)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: bits" << std::endl;
+
+    // init grid from file
+    Timing::getInstance()->startSetup();
+    if (!checkpointer.load(fileI, LAYOUT_BITS, generations)) exit(EXIT_FAILURE);
+    if (!emitter.start(LAYOUT_BITS, bitCells)) exit(EXIT_FAILURE);
+    cycles.start(LAYOUT_BITS, true);
+
+    if (threads != omp_get_num_threads()) omp_set_num_threads(threads);
+    if (debugOutput) std::cout << "number of processors: " << omp_get_num_procs() << ", set number of threads: " << threads << std::endl;
+
+    oldBitCells = new uint64_t[(size_t)words_per_row * h];
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    for (unsigned int gen = 0; gen < generations; gen++)
+    {
+        TIMING_SCOPE("generation");
+        withRule(rule, [&](auto r) { bitsGeneration(bitCells, oldBitCells, r); });
+        std::swap(bitCells, oldBitCells);
+        checkpointer.after(gen + 1, bitCells);
+        emitter.after(gen + 1, bitCells);
+        gen += cycles.after(gen + 1, bitCells, generations);
+    }
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+
+    // write out result
+    Timing::getInstance()->startFinalization();
+    saveBoard(fileO, LAYOUT_BITS);
+    checkpointer.finish();
+    emitter.finish();
+    Timing::getInstance()->stopFinalization();
+}
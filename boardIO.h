@@ -0,0 +1,193 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+board io:
+picks the file format for --load / --save by the extension of the filename:
+    .golb       binary snapshot (golbIO.h)
+    .rle        run length encoded pattern (rleIO.h)
+    otherwise   .gol text (golIO.h)
+
+while a BoardWriter is started (--batch), saveBoard does not write itself: it
+hands the board over to the writer thread and detaches it from the globals,
+so the next board can be loaded and calculated while the last one is still
+written. the writer frees the board afterwards. the other way round --batch
+reads the next board on its own thread into preloadedBoard, which loadBoard
+takes over instead of reading the file again.
+
+--------------------------------------------------------------------------- */
+
+#include "golIO.h"
+#include "golbIO.h"
+#include "rleIO.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#define BOARD_WRITER_QUEUE 2 // boards waiting to be written before saveBoard blocks
+
+// reads a board in any supported format into board, the globals are not touched
+bool readBoard(const char* filePath, GolLayout layout, BoardView& board)
+{
+    if (isGolbFile(filePath)) return loadGolb(filePath, layout, board);
+    if (isRleFile(filePath)) return loadRle(filePath, layout, board);
+    return loadGol(filePath, layout, board);
+}
+
+// a board read ahead (--batch), used by the next loadBoard of the same file and layout
+struct PreloadedBoard
+{
+    std::string path;       // empty if there is none
+    GolLayout layout;
+    bool loaded;            // false if reading failed, the reason is already reported
+    BoardView board;
+};
+
+PreloadedBoard preloadedBoard = { "", LAYOUT_BYTES, false, {} };
+
+// takes the preloaded board if it is filePath in layout, frees it otherwise
+bool takePreloaded(const char* filePath, GolLayout layout, PreloadedBoard& taken)
+{
+    if (preloadedBoard.path.empty()) return false;
+    taken = preloadedBoard;
+    preloadedBoard = { "", LAYOUT_BYTES, false, {} };
+    if (taken.path == filePath && taken.layout == layout) return true;
+
+    delete[] taken.board.cells;
+    delete[] taken.board.bitCells;
+    return false;
+}
+
+// loads a board in any supported format as the current one, returns false if it can not be read
+bool loadBoard(const char* filePath, GolLayout layout)
+{
+    PreloadedBoard preloaded;
+    if (takePreloaded(filePath, layout, preloaded))
+    {
+        if (!preloaded.loaded) return false;
+        useBoard(preloaded.board);
+        return true;
+    }
+
+    BoardView board;
+    if (!readBoard(filePath, layout, board)) return false;
+    useBoard(board);
+    return true;
+}
+
+// writes board in the format given by the extension
+bool writeBoard(const char* filePath, GolLayout layout, const BoardView& board)
+{
+    if (isGolbFile(filePath)) return writeGolb(filePath, layout, board);
+    if (isRleFile(filePath)) return writeRle(filePath, layout, board);
+    return writeGol(filePath, layout, board);
+}
+
+class BoardWriter
+{
+public:
+    ~BoardWriter() { finish(); }
+
+    bool active() const { return mWriter.joinable(); }
+
+    void start()
+    {
+        if (active()) return;
+        mStop = false;
+        mFailed = false;
+        mWriter = std::thread(&BoardWriter::writeLoop, this);
+    }
+
+    // queues the current board for writing and takes it over, blocks while the queue is full
+    void submit(const char* filePath, GolLayout layout)
+    {
+        Job job = { filePath, layout, currentBoard() };
+        if (layout == LAYOUT_BITS)
+        {
+            job.board.cells = 0;
+            bitCells = 0;
+        }
+        else
+        {
+            job.board.bitCells = 0;
+            cells = 0;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [this] { return mQueue.size() < BOARD_WRITER_QUEUE; });
+        mQueue.push_back(job);
+        lock.unlock();
+        mWake.notify_all();
+    }
+
+    // writes all queued boards and stops the thread, false if any could not be written
+    bool finish()
+    {
+        if (!active()) return true;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        mWriter.join();
+        return !mFailed;
+    }
+
+private:
+    struct Job
+    {
+        std::string path;
+        GolLayout layout;
+        BoardView board;
+    };
+
+    void writeLoop()
+    {
+        // keep the formatting on this thread, the omp threads belong to the computation
+        omp_set_num_threads(1);
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            mWake.wait(lock, [this] { return !mQueue.empty() || mStop; });
+            if (mQueue.empty()) break;
+            Job job = mQueue.front();
+            lock.unlock();
+
+            if (!writeBoard(job.path.c_str(), job.layout, job.board)) mFailed = true;
+            delete[] job.board.cells;
+            delete[] job.board.bitCells;
+
+            lock.lock();
+            mQueue.pop_front();
+            mWake.notify_all();
+        }
+    }
+
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::deque<Job> mQueue;
+    bool mStop = false;
+    bool mFailed = false;
+};
+
+BoardWriter boardWriter;
+
+// saves the board in the format given by the extension, or queues it while the writer is started
+bool saveBoard(const char* filePath, GolLayout layout)
+{
+    if (boardWriter.active())
+    {
+        boardWriter.submit(filePath, layout);
+        return true;
+    }
+    return writeBoard(filePath, layout, currentBoard());
+}
+
+// saves a board the caller keeps (e.g. a mapped device buffer) without copying it, so it is
+// written right away also while the writer is started, which would need a copy it owns
+bool saveBoard(const char* filePath, GolLayout layout, const BoardView& board)
+{
+    return writeBoard(filePath, layout, board);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+checkpoints:
+with --checkpoint-every N the board is written every N generations to
+<--checkpoint-dir>/checkpoint_<gen>.golb, gen counting the generations of the
+run (the snapshot itself stores the absolute board_generation).
+
+the compute thread only copies the current board into a spare buffer (one
+memcpy, its duration is added to Timing as "checkpoint copy ms") and wakes a
+background writer thread, which encodes and writes the snapshot while the
+next generations are calculated. modes advancing several generations at
+once (--time-block, --ocl-kernel tiled) shorten the block before each
+checkpoint, so every checkpoint is taken at a multiple of N. if the writer is still busy when the next
+checkpoint is due, the waiting copy is replaced by the newer one. snapshots
+are written to a temporary file and renamed when complete, so a crash never
+leaves a partial checkpoint behind; only the last CHECKPOINT_KEEP are kept.
+
+--resume loads the checkpoint with the highest generation that is not above
+--generations and passes the crc checks of the golb loader (damaged ones are
+skipped) and only runs the remaining generations. without a checkpoint the
+board is loaded from --load as usual.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+#include "omp.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <deque>
+
+#define CHECKPOINT_KEEP 2
+
+unsigned int checkpointEvery = 0;       // --checkpoint-every, 0 = off
+std::string checkpointDir = ".";        // --checkpoint-dir
+bool resumeCheckpoint = false;          // --resume
+
+class Checkpointer
+{
+public:
+    ~Checkpointer() { finish(); }
+
+    // loads the latest valid checkpoint (--resume) or fileI, reduces generations by
+    // the generations already done and starts the writer thread if checkpoints are on
+    bool load(const char* fileI, GolLayout layout, unsigned int& generations)
+    {
+        mLayout = layout;
+        mDone = 0;
+        bool loaded = false;
+        if (resumeCheckpoint)
+        {
+            std::vector<unsigned int> found = list();
+            for (auto it = found.rbegin(); it != found.rend() && !loaded; ++it)
+            {
+                if (*it > generations) continue;
+                std::string path = fileName(*it);
+                loaded = loadBoard(path.c_str(), layout);
+                if (loaded) mDone = *it;
+                else std::cerr << "skipping checkpoint " << path << std::endl;
+            }
+            if (loaded) std::cerr << "resuming from generation " << mDone << std::endl;
+        }
+        if (!loaded && !loadBoard(fileI, layout)) return false;
+        generations -= mDone;
+        mBaseGeneration = board_generation;
+
+        if (checkpointEvery > 0)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(checkpointDir, error);
+            mLast = mDone / checkpointEvery;
+            mSize = (layout == LAYOUT_BITS) ? (size_t)words_per_row * h * sizeof(uint64_t) : total_elem_count;
+            mPending.resize(mSize);
+            mWriting.resize(mSize);
+            mStop = false;
+            mWriter = std::thread(&Checkpointer::writeLoop, this);
+        }
+        return true;
+    }
+
+    // called with the count of generations calculated in this run and the current board,
+    // copies the board for the writer when a multiple of --checkpoint-every was reached
+    inline void after(unsigned int gens, const void* board)
+    {
+        if (due(gens)) submit(gens, board);
+    }
+
+    // true once a multiple of --checkpoint-every was reached, for callers which fetch the
+    // board first (ocl reads it back from the device) and pass it to submit later
+    inline bool due(unsigned int gens)
+    {
+        if (checkpointEvery == 0 || (mDone + gens) / checkpointEvery == mLast) return false;
+        mLast = (mDone + gens) / checkpointEvery;
+        return true;
+    }
+
+    // shortens a block of count generations starting after gens so it ends on the next
+    // checkpoint instead of passing it, for modes advancing several generations at once
+    inline unsigned int limit(unsigned int gens, unsigned int count) const
+    {
+        if (checkpointEvery == 0) return count;
+        return std::min(count, checkpointEvery - (mDone + gens) % checkpointEvery);
+    }
+
+    // copies the board after gens generations of this run for the writer
+    void submit(unsigned int gens, const void* board)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            memcpy(mPending.data(), board, mSize);
+            mPendingGen = mDone + gens;
+            mHasPending = true;
+        }
+        mWake.notify_one();
+        std::chrono::duration<double, std::milli> copy = std::chrono::high_resolution_clock::now() - start;
+        Timing::getInstance()->addValue("checkpoint copy ms", copy.count());
+    }
+
+    // waits until the last checkpoint is written and stops the writer thread
+    void finish()
+    {
+        if (!mWriter.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_one();
+        mWriter.join();
+    }
+
+private:
+    std::string fileName(unsigned int gen) const
+    {
+        return checkpointDir + "/checkpoint_" + std::to_string(gen) + ".golb";
+    }
+
+    // generations of all checkpoint files in checkpointDir, ascending
+    std::vector<unsigned int> list() const
+    {
+        std::vector<unsigned int> found;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(checkpointDir, error))
+        {
+            std::string name = entry.path().filename().string();
+            const std::string prefix = "checkpoint_";
+            const std::string suffix = ".golb";
+            if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) continue;
+            std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+            if (digits.find_first_not_of("0123456789") == std::string::npos && digits.size() < 10) found.push_back(std::stoul(digits));
+        }
+        std::sort(found.begin(), found.end());
+        return found;
+    }
+
+    void writeLoop()
+    {
+        // keep the encoding on this thread, the omp threads belong to the computation
+        omp_set_num_threads(1);
+        std::deque<unsigned int> written;
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            mWake.wait(lock, [this] { return mHasPending || mStop; });
+            if (!mHasPending) break;
+            std::swap(mPending, mWriting);
+            unsigned int gen = mPendingGen;
+            mHasPending = false;
+            lock.unlock();
+
+            uint64_t generation = mBaseGeneration + (gen - mDone);
+            std::string path = fileName(gen);
+            std::string temp = path + ".tmp";
+            std::error_code error;
+            BoardView board = { w, h, words_per_row, mWriting.data(), (const uint64_t*)mWriting.data(), generation };
+            if (writeGolb(temp.c_str(), mLayout, board))
+            {
+                std::filesystem::rename(temp, path, error);
+                written.push_back(gen);
+                if (written.size() > CHECKPOINT_KEEP)
+                {
+                    std::filesystem::remove(fileName(written.front()), error);
+                    written.pop_front();
+                }
+            }
+            else std::filesystem::remove(temp, error);
+
+            lock.lock();
+        }
+    }
+
+    GolLayout mLayout = LAYOUT_BYTES;
+    unsigned int mDone = 0;         // generations done before this run (resumed)
+    unsigned int mLast = 0;         // index of the last checkpoint, (generation / every)
+    uint64_t mBaseGeneration = 0;   // board_generation after loading
+    size_t mSize = 0;
+
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::vector<unsigned char> mPending;
+    std::vector<unsigned char> mWriting;
+    unsigned int mPendingGen = 0;
+    bool mHasPending = false;
+    bool mStop = false;
+};
+
+Checkpointer checkpointer;
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint> // uint64_t
+
+#include "rule.h"
+
 #define STATE_DEAD  0x00
 #define STATE_ALIVE 0x01
 
@@ -14,7 +18,35 @@ int row_bot;        // defines last row (h - 1)
 //      LSB is state 0 = dead, 1... alive
 //      other bits are number of neighbours
 unsigned char* cells;
-unsigned char* oldCells;    // used in seqMode as buffer
-int* neighbours;  // ompMode data centric design
+unsigned char* oldCells;    // used in seqMode as buffer, in ompMode as ping-pong buffer
+
+// in bitsMode each cell is represented as a single bit, 64 cells per word:
+//      bit i of word k in a row is the cell at x = 64 * k + i
+//      bits beyond col_right in the last word of a row are always 0
+uint64_t* bitCells;
+uint64_t* oldBitCells;      // used in bitsMode as ping-pong buffer
+unsigned int words_per_row;
+
+uint64_t board_generation = 0; // generation of the board in memory, kept in .golb snapshots
+
+Rule rule = { RULE_CONWAY_BIRTH, RULE_CONWAY_SURVIVE }; // --rule, see rule.h
+
+// everything the writers need of a board, so it can still be written while the
+// globals already describe the next one (see BoardWriter in boardIO.h)
+struct BoardView
+{
+    unsigned int w;
+    unsigned int h;
+    unsigned int words_per_row;
+    const unsigned char* cells;     // bytes and seq layout
+    const uint64_t* bitCells;       // bits layout
+    uint64_t generation;
+};
+
+// the board described by the globals
+inline BoardView currentBoard()
+{
+    return { w, h, words_per_row, cells, bitCells, board_generation };
+}
 
 bool debugOutput = false; // flag for console output
\ No newline at end of file
@@ -0,0 +1,142 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+cycle detection (--cycles):
+random boards end in still lifes and oscillators (mostly period 1 and 2)
+long before the last generation. with --cycles the board is hashed after
+every generation (64 bit, words mixed with their position and xor'ed, so
+the omp threads hash their row bands in parallel) and the hash is looked up
+in the hashes of the last CYCLE_HISTORY generations.
+
+a match at generation g with generation g - p is only a candidate: the board
+is copied and compared byte by byte p generations later. if it is equal
+again, the board repeats with period p and the loop skips ahead to the
+generation with the same state as the requested one, so only
+(generations - g) mod p generations are still calculated. a hash collision
+only costs the copy.
+
+reported in Timing as "cycle period", "cycle generation" (generation of
+this run where the repeat was first seen) and "cycle skipped" generations.
+
+used by seq, omp (all variants), bits, simd and lut. not with checkpoints or
+the frame stream, those need every generation. ocl keeps its queue running
+without looking at the board, sparse and hashlife have their own shortcuts
+for stable areas.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "omp.h"
+
+#define CYCLE_HISTORY 64 // generations kept, longest period found
+
+bool cycleDetect = false; // --cycles
+
+class CycleDetector
+{
+public:
+    // starts a run on a board of the layout, parallel hashes with the omp threads
+    void start(GolLayout layout, bool parallel)
+    {
+        mActive = cycleDetect && checkpointEvery == 0 && emitEvery == 0;
+        mParallel = parallel;
+        mCount = 0;
+        mVerifyAt = 0;
+        mSize = (layout == LAYOUT_BITS) ? (size_t)words_per_row * h * sizeof(uint64_t) : total_elem_count;
+    }
+
+    // called with the count of generations calculated in this run and the current board,
+    // returns the generations to skip once a cycle is confirmed (0 otherwise)
+    inline unsigned int after(unsigned int gens, const void* board, unsigned int generations)
+    {
+        if (!mActive) return 0;
+        return check(gens, board, generations);
+    }
+
+private:
+    unsigned int check(unsigned int gens, const void* board, unsigned int generations)
+    {
+        if (mVerifyAt != 0 && gens >= mVerifyAt)
+        {
+            bool repeated = gens == mVerifyAt && memcmp(mCandidate.data(), board, mSize) == 0;
+            mVerifyAt = 0;
+            if (repeated)
+            {
+                mActive = false;
+                unsigned int skipped = (generations - gens) / mPeriod * mPeriod;
+                Timing::getInstance()->addValue("cycle period", mPeriod);
+                Timing::getInstance()->addValue("cycle generation", mFound);
+                Timing::getInstance()->addValue("cycle skipped", skipped);
+                if (debugOutput) std::cout << "cycle: period " << mPeriod << " found at generation " << mFound << ", skipping " << skipped << " generations" << std::endl;
+                return skipped;
+            }
+        }
+
+        uint64_t hash = hashBoard((const unsigned char*)board);
+        if (mVerifyAt == 0)
+        {
+            // newest first, so the shortest period wins
+            for (unsigned int i = 1; i <= std::min(mCount, (unsigned int)CYCLE_HISTORY); i++)
+            {
+                const Entry& entry = mHistory[(mCount - i) % CYCLE_HISTORY];
+                if (entry.hash != hash) continue;
+                mPeriod = gens - entry.gens;
+                mFound = gens;
+                mVerifyAt = gens + mPeriod;
+                mCandidate.resize(mSize);
+                memcpy(mCandidate.data(), board, mSize);
+                break;
+            }
+        }
+        mHistory[mCount % CYCLE_HISTORY] = { hash, gens };
+        mCount++;
+        return 0;
+    }
+
+    // every 64 bit word mixed with its index (splitmix64 finalizer), xor'ed in any order
+    static inline uint64_t mix(uint64_t value)
+    {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ull;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+
+    uint64_t hashBoard(const unsigned char* board) const
+    {
+        int64_t words = (int64_t)(mSize / sizeof(uint64_t));
+        uint64_t hash = 0;
+        int64_t i;
+#pragma omp parallel for reduction(^ : hash) schedule(static) if (mParallel)
+        for (i = 0; i < words; i++)
+        {
+            uint64_t word;
+            memcpy(&word, board + i * sizeof(uint64_t), sizeof(word));
+            hash ^= mix(word + (uint64_t)i * 0x9e3779b97f4a7c15ull);
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, board + words * sizeof(uint64_t), mSize % sizeof(uint64_t));
+        return hash ^ mix(tail + (uint64_t)words * 0x9e3779b97f4a7c15ull);
+    }
+
+    struct Entry
+    {
+        uint64_t hash;
+        unsigned int gens;
+    };
+
+    bool mActive = false;
+    bool mParallel = false;
+    size_t mSize = 0;
+    Entry mHistory[CYCLE_HISTORY];
+    unsigned int mCount = 0;        // generations hashed, mHistory is a ring over them
+    unsigned int mPeriod = 0;
+    unsigned int mFound = 0;
+    unsigned int mVerifyAt = 0;     // generation of the candidate's comparison, 0 = none
+    std::vector<unsigned char> mCandidate;
+};
+
+CycleDetector cycles;
@@ -0,0 +1,505 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+distributed mode:
+the board is split into horizontal bands, one per worker process (rank). a
+rank only holds its band plus K halo rows above and below, so the board does
+not need to fit into the memory of one process:
+
+    rows [0, K)                 halo, last K rows of the upper neighbour
+    rows [K, K + band)          own band
+    rows [K + band, 2K + band)  halo, first K rows of the lower neighbour
+
+every K generations the ranks exchange their outer K rows with both
+neighbours on the torus (rank 0 and the last rank are neighbours), then
+calculate K generations without talking to anyone: generation g is calculated
+for rows [g, rows - g), the valid area shrinks by one row per generation, so
+after K generations exactly the own band is valid again. columns wrap around
+like in the other modes, the rows are calculated by ompCells on --threads
+threads per rank.
+
+the exchange goes through a DistTransport:
+    shm     mailboxes in shared memory, mapped before the ranks are forked
+    tcp     one localhost connection to each neighbour, the listening
+            sockets are opened before the ranks are forked
+
+each rank reads only its band of the .gol file (rows are located by offset,
+all rows have the same length) and writes it at its offset into the output,
+which the starting process created with header and final size. only .gol
+files are supported and the ranks are started with fork, so this mode is not
+available on windows.
+
+the starting process measures the phases: setup ends when every rank loaded
+its band, computation when every rank finished its generations.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "ompMode.h" // ompCells
+#include "boardIO.h"
+
+#ifndef _WIN32
+#include <atomic>
+#include <thread>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+// moves the outer rows of a band to the neighbours and the halos back
+class DistTransport
+{
+public:
+    virtual ~DistTransport() {}
+
+    // sends toUp to the upper and toDown to the lower neighbour, receives the rows the
+    // upper neighbour sent down into fromUp and the rows the lower one sent up into fromDown
+    virtual bool exchange(const unsigned char* toUp, const unsigned char* toDown, unsigned char* fromUp, unsigned char* fromDown) = 0;
+};
+
+#ifndef _WIN32
+
+// progress of all ranks, in shared memory
+struct DistStatus
+{
+    std::atomic<int> setupDone;
+    std::atomic<int> computeDone;
+};
+
+// anonymous shared mapping, inherited by the forked ranks
+inline void* distShared(size_t size)
+{
+    void* memory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return (memory == MAP_FAILED) ? 0 : memory;
+}
+
+// every rank owns two mailboxes (rows for the upper and for the lower neighbour) and
+// two counters: exchanges published into its mailboxes and exchanges read from its neighbours
+class ShmTransport : public DistTransport
+{
+public:
+    struct Counters
+    {
+        std::atomic<uint64_t> published;
+        std::atomic<uint64_t> consumed;
+    };
+
+    // shared memory for ranks mailboxes of size bytes each, to be called before forking
+    static void* create(int ranks, size_t size)
+    {
+        void* memory = distShared(ranks * (sizeof(Counters) + 2 * size));
+        if (memory == 0) return 0;
+        Counters* counters = (Counters*)memory;
+        for (int r = 0; r < ranks; r++)
+        {
+            new (&counters[r].published) std::atomic<uint64_t>(0);
+            new (&counters[r].consumed) std::atomic<uint64_t>(0);
+        }
+        return memory;
+    }
+
+    ShmTransport(void* memory, int rank, int ranks, size_t size)
+        : mCounters((Counters*)memory), mBoxes((unsigned char*)memory + ranks * sizeof(Counters)),
+        mRank(rank), mUp((rank + ranks - 1) % ranks), mDown((rank + 1) % ranks), mSize(size)
+    {
+    }
+
+    bool exchange(const unsigned char* toUp, const unsigned char* toDown, unsigned char* fromUp, unsigned char* fromDown) override
+    {
+        uint64_t step = ++mStep;
+
+        // the neighbours must have read the previous rows before they are overwritten
+        while (mCounters[mUp].consumed.load(std::memory_order_acquire) < step - 1 ||
+            mCounters[mDown].consumed.load(std::memory_order_acquire) < step - 1) std::this_thread::yield();
+        memcpy(box(mRank, 0), toUp, mSize);
+        memcpy(box(mRank, 1), toDown, mSize);
+        mCounters[mRank].published.store(step, std::memory_order_release);
+
+        while (mCounters[mUp].published.load(std::memory_order_acquire) < step ||
+            mCounters[mDown].published.load(std::memory_order_acquire) < step) std::this_thread::yield();
+        memcpy(fromUp, box(mUp, 1), mSize);
+        memcpy(fromDown, box(mDown, 0), mSize);
+        mCounters[mRank].consumed.store(step, std::memory_order_release);
+        return true;
+    }
+
+private:
+    unsigned char* box(int rank, int down) { return mBoxes + ((size_t)rank * 2 + down) * mSize; }
+
+    Counters* mCounters;
+    unsigned char* mBoxes;
+    int mRank, mUp, mDown;
+    size_t mSize;
+    uint64_t mStep = 0;
+};
+
+// one connection to each neighbour: the rank connects to the listener of its lower
+// neighbour and accepts the connection of its upper neighbour on its own listener
+class TcpTransport : public DistTransport
+{
+public:
+    // listening socket on a free localhost port, to be called before forking
+    static int listenLocal(unsigned short& port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t len = sizeof(addr);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0 || getsockname(fd, (sockaddr*)&addr, &len) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+        port = ntohs(addr.sin_port);
+        return fd;
+    }
+
+    TcpTransport(int listener, unsigned short downPort, size_t size) : mSize(size)
+    {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(downPort);
+        mDown = socket(AF_INET, SOCK_STREAM, 0);
+        if (mDown >= 0 && connect(mDown, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            ::close(mDown);
+            mDown = -1;
+        }
+        mUp = (mDown >= 0) ? accept(listener, 0, 0) : -1;
+
+        int on = 1;
+        if (mDown >= 0) setsockopt(mDown, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (mUp >= 0) setsockopt(mUp, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+
+    ~TcpTransport()
+    {
+        if (mUp >= 0) ::close(mUp);
+        if (mDown >= 0) ::close(mDown);
+    }
+
+    bool connected() const { return mUp >= 0 && mDown >= 0; }
+
+    // sends and receives on both connections at once, so no side waits for a full buffer
+    bool exchange(const unsigned char* toUp, const unsigned char* toDown, unsigned char* fromUp, unsigned char* fromDown) override
+    {
+        const unsigned char* out[2] = { toUp, toDown };
+        unsigned char* in[2] = { fromUp, fromDown };
+        int fds[2] = { mUp, mDown };
+        size_t sent[2] = { 0, 0 };
+        size_t received[2] = { 0, 0 };
+
+        while (sent[0] < mSize || sent[1] < mSize || received[0] < mSize || received[1] < mSize)
+        {
+            pollfd polls[2];
+            for (int i = 0; i < 2; i++)
+            {
+                polls[i].fd = fds[i];
+                polls[i].events = (sent[i] < mSize ? POLLOUT : 0) | (received[i] < mSize ? POLLIN : 0);
+                polls[i].revents = 0;
+            }
+            if (poll(polls, 2, -1) < 0) return false;
+
+            for (int i = 0; i < 2; i++)
+            {
+                if (polls[i].revents & (POLLERR | POLLNVAL)) return false;
+                if (polls[i].revents & POLLOUT)
+                {
+                    ssize_t n = send(fds[i], out[i] + sent[i], mSize - sent[i], MSG_NOSIGNAL);
+                    if (n < 0) return false;
+                    sent[i] += n;
+                }
+                if (polls[i].revents & (POLLIN | POLLHUP))
+                {
+                    ssize_t n = recv(fds[i], in[i] + received[i], mSize - received[i], 0);
+                    if (n <= 0) return false;
+                    received[i] += n;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    int mUp = -1;
+    int mDown = -1;
+    size_t mSize;
+};
+
+// loads rows [y0, y1) of the .gol file into the band of cells, rows are found by offset
+bool distLoadBand(const char* filePath, size_t rowsOffset, size_t rowLen, unsigned int width, unsigned int y0, unsigned int y1, unsigned int halo)
+{
+    int fd = ::open(filePath, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    std::vector<char> text(rowLen * (y1 - y0));
+    ssize_t count = pread(fd, text.data(), text.size(), (off_t)(rowsOffset + rowLen * y0));
+    ::close(fd);
+    bool ok = count >= 0;
+    size_t read = ok ? (size_t)count : 0;
+
+    // the last row of the file may miss its newline
+    for (unsigned int y = y0; ok && y < y1; y++)
+    {
+        const char* row = text.data() + rowLen * (y - y0);
+        size_t end = rowLen * (y - y0) + width;
+        ok = (end <= read) && (end == read || row[width] == '\n' || (row[width] == '\r' && rowLen == width + 2u));
+        if (ok) convertRowBytes(row, cells + (size_t)(halo + y - y0) * width, width);
+        else std::cerr << "error reading " << filePath << ": row " << y << " does not have " << width << " cells" << std::endl;
+    }
+    return ok;
+}
+
+// writes the own band into its rows of the output file
+bool distSaveBand(const char* filePath, size_t rowsOffset, unsigned int y0, unsigned int rows, unsigned int halo)
+{
+    int fd = ::open(filePath, O_WRONLY);
+    if (fd < 0)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    size_t rowLen = (size_t)w + 1;
+    std::vector<char> text(rowLen * rows);
+    BoardView board = currentBoard();
+    int y;
+#pragma omp parallel for schedule(static)
+    for (y = 0; y < (int)rows; y++)
+    {
+        char* dst = text.data() + y * rowLen;
+        formatRow(dst, board, halo + y, LAYOUT_BYTES);
+        dst[w] = '\n';
+    }
+    bool ok = pwrite(fd, text.data(), text.size(), (off_t)(rowsOffset + rowLen * y0)) == (ssize_t)text.size();
+    ok = (::close(fd) == 0) && ok;
+    if (!ok) std::cerr << "error writing " << filePath << std::endl;
+    return ok;
+}
+
+// work of one forked rank, returns the exit code
+int distRank(int rank, int ranks, DistTransport& transport, DistStatus* status, const char* fileI, const char* fileO,
+    unsigned int width, unsigned int height, size_t rowsOffsetI, size_t rowLenI, size_t rowsOffsetO,
+    unsigned int generations, int threads, unsigned int halo)
+{
+    unsigned int y0 = (unsigned int)((uint64_t)height * rank / ranks);
+    unsigned int y1 = (unsigned int)((uint64_t)height * (rank + 1) / ranks);
+    unsigned int band = y1 - y0;
+
+    // the globals describe the local rows, so ompCells never wraps vertically
+    setDimensions(width, band + 2 * halo);
+    cells = new unsigned char[total_elem_count];
+    oldCells = new unsigned char[total_elem_count];
+    memset(cells, 0, total_elem_count);
+    if (!distLoadBand(fileI, rowsOffsetI, rowLenI, width, y0, y1, halo)) return EXIT_FAILURE;
+    omp_set_num_threads(threads);
+    status->setupDone++;
+
+    size_t haloBytes = (size_t)halo * w;
+    for (unsigned int gen = 0; gen < generations; gen += halo)
+    {
+        unsigned int steps = std::min(halo, generations - gen);
+        if (!transport.exchange(cells + haloBytes, cells + (size_t)band * w, cells, cells + haloBytes + (size_t)band * w))
+        {
+            std::cerr << "rank " << rank << ": halo exchange failed" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        for (unsigned int g = 1; g <= steps; g++)
+        {
+            int last = (int)h - (int)g;
+            withRule(rule, [&](auto r)
+            {
+                int row;
+#pragma omp parallel for schedule(static)
+                for (row = (int)g; row < last; row++)
+                {
+                    ompCells(cells, oldCells, row, 0, (int)w, r);
+                }
+            });
+            std::swap(cells, oldCells);
+        }
+    }
+    status->computeDone++;
+
+    return distSaveBand(fileO, rowsOffsetO, y0, band, halo) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// waits until counter reached ranks, false if a rank failed before (all ranks are stopped then)
+bool distWait(const std::atomic<int>* counter, int ranks, std::vector<pid_t>& pids)
+{
+    while (counter == 0 || *counter < ranks)
+    {
+        int wstatus;
+        pid_t pid = waitpid(-1, &wstatus, WNOHANG);
+        if (pid > 0)
+        {
+            std::replace(pids.begin(), pids.end(), pid, (pid_t)0);
+            if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+            {
+                for (pid_t other : pids) if (other > 0) kill(other, SIGTERM);
+                while (wait(0) > 0);
+                return false;
+            }
+        }
+        else if (pid < 0) return counter == 0;  // all ranks exited
+        else std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    return true;
+}
+
+#endif
+
+void runDist(const char* fileI, const char* fileO, unsigned int generations, int threads, int ranks, const std::string& transportName, unsigned int halo)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: dist" << std::endl;
+
+#ifdef _WIN32
+    std::cerr << "dist mode needs fork and is not available on windows" << std::endl;
+    exit(EXIT_FAILURE);
+#else
+    Timing::getInstance()->startSetup();
+    if (isGolbFile(fileI) || isRleFile(fileI) || isGolbFile(fileO) || isRleFile(fileO))
+    {
+        std::cerr << "dist mode only reads and writes .gol files" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // header and first row give the size and the length of every row
+    unsigned int width = 0, height = 0;
+    size_t rowsOffsetI = 0;
+    size_t rowLenI = 0;
+    {
+        MappedFile file;
+        if (!file.open(fileI))
+        {
+            std::cerr << "error opening " << fileI << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        rowsOffsetI = parseGolHeader(file.data(), file.size(), width, height);
+        if (rowsOffsetI > 0 && rowsOffsetI + width <= file.size())
+        {
+            bool crlf = rowsOffsetI + width < file.size() && file.data()[rowsOffsetI + width] == '\r';
+            rowLenI = crlf ? width + 2 : width + 1;
+        }
+        if (rowLenI == 0)
+        {
+            std::cerr << "error reading " << fileI << ": missing or malformed header" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (ranks < 1 || (unsigned int)ranks > height)
+    {
+        std::cerr << "dist mode needs 1 to " << height << " ranks" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    halo = std::max(1u, std::min(halo, height / ranks)); // the halo must come from the direct neighbours only
+    size_t haloBytes = (size_t)halo * width;
+    if (debugOutput) std::cout << "ranks: " << ranks << ", transport: " << transportName << ", halo: " << halo << std::endl;
+
+    // output with header and final size, every rank fills its rows
+    std::string header = std::to_string(width) + "," + std::to_string(height) + "\n";
+    int fd = ::open(fileO, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && pwrite(fd, header.data(), header.size(), 0) == (ssize_t)header.size() &&
+        ftruncate(fd, (off_t)(header.size() + ((size_t)width + 1) * height)) == 0;
+    if (fd >= 0) ::close(fd);
+    if (!ok)
+    {
+        std::cerr << "error writing " << fileO << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    DistStatus* status = (DistStatus*)distShared(sizeof(DistStatus));
+    void* mailboxes = 0;
+    std::vector<int> listeners(ranks, -1);
+    std::vector<unsigned short> ports(ranks, 0);
+    if (transportName == "tcp")
+    {
+        for (int r = 0; r < ranks; r++) listeners[r] = TcpTransport::listenLocal(ports[r]);
+        ok = std::find(listeners.begin(), listeners.end(), -1) == listeners.end();
+    }
+    else if (transportName == "shm") ok = (mailboxes = ShmTransport::create(ranks, haloBytes)) != 0;
+    else
+    {
+        std::cerr << "unknown transport " << transportName << ", use shm or tcp" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (status == 0 || !ok)
+    {
+        std::cerr << "dist mode: could not create the " << transportName << " transport" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    new (&status->setupDone) std::atomic<int>(0);
+    new (&status->computeDone) std::atomic<int>(0);
+
+    // forked ranks must not flush what is buffered in this process
+    std::cout.flush();
+    std::cerr.flush();
+    std::vector<pid_t> pids(ranks, 0);
+    for (int r = 0; r < ranks; r++)
+    {
+        pids[r] = fork();
+        if (pids[r] == 0)
+        {
+            int result = EXIT_FAILURE;
+            if (mailboxes != 0)
+            {
+                ShmTransport transport(mailboxes, r, ranks, haloBytes);
+                result = distRank(r, ranks, transport, status, fileI, fileO, width, height, rowsOffsetI, rowLenI, header.size(), generations, threads, halo);
+            }
+            else
+            {
+                for (int other = 0; other < ranks; other++) if (other != r) ::close(listeners[other]);
+                TcpTransport transport(listeners[r], ports[(r + 1) % ranks], haloBytes);
+                if (transport.connected()) result = distRank(r, ranks, transport, status, fileI, fileO, width, height, rowsOffsetI, rowLenI, header.size(), generations, threads, halo);
+                else std::cerr << "rank " << r << ": could not connect to its neighbours" << std::endl;
+            }
+            std::cout.flush();
+            std::cerr.flush();
+            _exit(result);
+        }
+        if (pids[r] < 0)
+        {
+            std::cerr << "dist mode: could not start rank " << r << std::endl;
+            for (int other = 0; other < r; other++) kill(pids[other], SIGTERM);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int listener : listeners) if (listener >= 0) ::close(listener);
+
+    ok = distWait(&status->setupDone, ranks, pids);
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    ok = ok && distWait(&status->computeDone, ranks, pids);
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+
+    // write out result (by the ranks)
+    Timing::getInstance()->startFinalization();
+    ok = ok && distWait(0, ranks, pids);
+    Timing::getInstance()->stopFinalization();
+
+    if (!ok)
+    {
+        std::cerr << "dist mode: a rank failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+#endif
+}
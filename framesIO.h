@@ -0,0 +1,339 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+frame stream io:
+with --emit-every N --emit <file> every N-th generation (and the loaded one)
+is appended as frame to one streaming file:
+
+    header          32 bytes, see FramesHeader
+    frames          bit packed board (bits layout, see common.h), XOR the
+                    previous frame and run length encoded (rleEncode)
+    index           one FramesEntry per frame
+    footer          FramesFooter, offset of the index and frame count
+
+every FRAMES_KEY_INTERVAL-th frame is a key frame stored against an empty
+board, so reading frame k only decodes the frames from the last key frame up
+to k. the index is written when the stream is closed.
+
+the compute thread copies the board into a free buffer of a bounded queue
+(one memcpy, recorded in Timing as "emit copy ms") and only blocks if all
+FRAMES_QUEUE_SIZE buffers are waiting. a writer thread packs, deltas,
+encodes and writes the frames in order. modes advancing several generations
+at once (--time-block, --ocl-kernel tiled) shorten the block before each
+frame, so frame k is always generation k * N.
+
+--extract-frame <k> reads frame k of the --emit file and saves it to --save.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h" // setDimensions, saveBoard, rleEncode, crc32
+#include "omp.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#define FRAMES_MAGIC "GOLF"
+#define FRAMES_INDEX_MAGIC "GOLI"
+#define FRAMES_VERSION 1
+#define FRAMES_KEY_INTERVAL 32
+#define FRAMES_QUEUE_SIZE 4
+
+unsigned int emitEvery = 0;             // --emit-every, 0 = off
+std::string emitFile = "frames.golf";   // --emit
+
+struct FramesHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t every;
+    uint32_t keyInterval;
+    uint8_t reserved[8];
+};
+
+struct FramesEntry
+{
+    uint64_t offset;        // from start of file
+    uint64_t generation;
+    uint32_t size;          // encoded bytes
+    uint32_t checksum;      // crc32 of the packed board (not the delta)
+};
+
+struct FramesFooter
+{
+    uint64_t indexOffset;
+    uint32_t frameCount;
+    char magic[4];
+};
+
+class FrameEmitter
+{
+public:
+    ~FrameEmitter() { finish(); }
+
+    // opens the stream and emits the loaded board as first frame
+    bool start(GolLayout layout, const void* board)
+    {
+        if (emitEvery == 0) return true;
+        mFile = fopen(emitFile.c_str(), "wb");
+        if (mFile == 0)
+        {
+            std::cerr << "error opening " << emitFile << std::endl;
+            return false;
+        }
+
+        FramesHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FRAMES_MAGIC, 4);
+        header.version = FRAMES_VERSION;
+        header.width = w;
+        header.height = h;
+        header.every = emitEvery;
+        header.keyInterval = FRAMES_KEY_INTERVAL;
+        mOk = fwrite(&header, sizeof(header), 1, mFile) == 1;
+        mOffset = sizeof(header);
+
+        mLayout = layout;
+        mBaseGeneration = board_generation;
+        mLast = 0;
+        mSize = (layout == LAYOUT_BITS) ? (size_t)words_per_row * h * sizeof(uint64_t) : total_elem_count;
+        for (int i = 0; i < FRAMES_QUEUE_SIZE; i++) mFree.push_back(new unsigned char[mSize]);
+        mStop = false;
+        mWriter = std::thread(&FrameEmitter::writeLoop, this);
+
+        submit(0, board);
+        return true;
+    }
+
+    // called with the count of generations calculated in this run and the current board,
+    // queues a copy when a multiple of --emit-every was reached
+    inline void after(unsigned int gens, const void* board)
+    {
+        if (due(gens)) submit(gens, board);
+    }
+
+    // true once a multiple of --emit-every was reached, for callers which fetch the
+    // board first (ocl reads it back from the device) and pass it to submit later
+    inline bool due(unsigned int gens)
+    {
+        if (emitEvery == 0 || gens / emitEvery == mLast) return false;
+        mLast = gens / emitEvery;
+        return true;
+    }
+
+    // shortens a block of count generations starting after gens so it ends on the next
+    // frame instead of passing it, for modes advancing several generations at once
+    inline unsigned int limit(unsigned int gens, unsigned int count) const
+    {
+        if (emitEvery == 0) return count;
+        return std::min(count, emitEvery - gens % emitEvery);
+    }
+
+    // writes the queued frames and the index, closes the stream
+    void finish()
+    {
+        if (!mWriter.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mWake.notify_all();
+        mWriter.join();
+
+        FramesFooter footer;
+        footer.indexOffset = mOffset;
+        footer.frameCount = (uint32_t)mIndex.size();
+        memcpy(footer.magic, FRAMES_INDEX_MAGIC, 4);
+        mOk = mOk && fwrite(mIndex.data(), sizeof(FramesEntry), mIndex.size(), mFile) == mIndex.size();
+        mOk = mOk && fwrite(&footer, sizeof(footer), 1, mFile) == 1;
+        mOk = (fclose(mFile) == 0) && mOk;
+        if (!mOk) std::cerr << "error writing " << emitFile << std::endl;
+
+        for (unsigned char* buffer : mFree) delete[] buffer;
+        mFree.clear();
+        mIndex.clear();
+    }
+
+    // queues a copy of the board after gens generations of this run
+    void submit(unsigned int gens, const void* board)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWake.wait(lock, [this] { return !mFree.empty(); });
+        unsigned char* buffer = mFree.back();
+        mFree.pop_back();
+        lock.unlock();
+
+        memcpy(buffer, board, mSize);
+
+        lock.lock();
+        mQueue.push_back({ buffer, mBaseGeneration + gens });
+        lock.unlock();
+        mWake.notify_all();
+        std::chrono::duration<double, std::milli> copy = std::chrono::high_resolution_clock::now() - start;
+        Timing::getInstance()->addValue("emit copy ms", copy.count());
+    }
+
+private:
+    struct Frame
+    {
+        unsigned char* board;
+        uint64_t generation;
+    };
+
+    void writeLoop()
+    {
+        // keep the encoding on this thread, the omp threads belong to the computation
+        omp_set_num_threads(1);
+        size_t words = (size_t)words_per_row * h;
+        std::vector<uint64_t> previous(words, 0);
+        std::vector<uint64_t> packed(words);
+        std::vector<unsigned char> encoded;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true)
+        {
+            mWake.wait(lock, [this] { return !mQueue.empty() || mStop; });
+            if (mQueue.empty()) break;
+            Frame frame = mQueue.front();
+            mQueue.pop_front();
+            lock.unlock();
+
+            if (mLayout == LAYOUT_BITS) memcpy(packed.data(), frame.board, words * sizeof(uint64_t));
+            else
+            {
+                std::fill(packed.begin(), packed.end(), 0);
+                for (unsigned int y = 0; y < h; y++)
+                {
+                    const unsigned char* row = frame.board + (size_t)y * w;
+                    uint64_t* dst = packed.data() + (size_t)y * words_per_row;
+                    for (unsigned int x = 0; x < w; x++) dst[x / 64] |= (uint64_t)(row[x] & STATE_ALIVE) << (x % 64);
+                }
+            }
+
+            lock.lock();
+            mFree.push_back(frame.board);
+            lock.unlock();
+            mWake.notify_all();
+
+            // key frames are stored against an empty board
+            bool key = mIndex.size() % FRAMES_KEY_INTERVAL == 0;
+            if (key) std::fill(previous.begin(), previous.end(), 0);
+            for (size_t i = 0; i < words; i++) previous[i] ^= packed[i];
+            rleEncode((const unsigned char*)previous.data(), words * sizeof(uint64_t), encoded);
+            previous.swap(packed);
+
+            FramesEntry entry;
+            entry.offset = mOffset;
+            entry.generation = frame.generation;
+            entry.size = (uint32_t)encoded.size();
+            entry.checksum = crc32((const unsigned char*)previous.data(), words * sizeof(uint64_t));
+            mOk = mOk && fwrite(encoded.data(), 1, encoded.size(), mFile) == encoded.size();
+            mOffset += encoded.size();
+            mIndex.push_back(entry);
+
+            lock.lock();
+        }
+    }
+
+    GolLayout mLayout = LAYOUT_BYTES;
+    uint64_t mBaseGeneration = 0;
+    unsigned int mLast = 0;         // index of the last emitted frame, (gens / every)
+    size_t mSize = 0;
+
+    FILE* mFile = 0;
+    bool mOk = true;
+    uint64_t mOffset = 0;
+    std::vector<FramesEntry> mIndex;
+
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::vector<unsigned char*> mFree;
+    std::deque<Frame> mQueue;
+    bool mStop = false;
+};
+
+FrameEmitter emitter;
+
+// loads frame k of a frame stream into bitCells, sets the dimensions and board_generation
+bool loadFrame(const char* filePath, unsigned int k)
+{
+    MappedFile file;
+    if (!file.open(filePath))
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)file.data();
+    size_t size = file.size();
+
+    FramesHeader header;
+    FramesFooter footer;
+    if (size < sizeof(header) + sizeof(footer))
+    {
+        std::cerr << "error reading " << filePath << ": file too small" << std::endl;
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+    if (memcmp(header.magic, FRAMES_MAGIC, 4) != 0 || header.version != FRAMES_VERSION || memcmp(footer.magic, FRAMES_INDEX_MAGIC, 4) != 0 ||
+        header.width == 0 || header.height == 0 || header.keyInterval == 0 || footer.indexOffset > size - sizeof(footer) ||
+        (size - sizeof(footer) - footer.indexOffset) / sizeof(FramesEntry) < footer.frameCount)
+    {
+        std::cerr << "error reading " << filePath << ": not a valid frame stream (incomplete?)" << std::endl;
+        return false;
+    }
+    if (k >= footer.frameCount)
+    {
+        std::cerr << "error reading " << filePath << ": frame " << k << " requested, stream has " << footer.frameCount << std::endl;
+        return false;
+    }
+
+    std::vector<FramesEntry> index(footer.frameCount);
+    memcpy(index.data(), data + footer.indexOffset, index.size() * sizeof(FramesEntry));
+
+    setDimensions(header.width, header.height);
+    size_t bytes = (size_t)words_per_row * h * sizeof(uint64_t);
+    std::vector<uint64_t> delta((size_t)words_per_row * h);
+    bitCells = new uint64_t[(size_t)words_per_row * h];
+    memset(bitCells, 0, bytes);
+
+    // decode from the last key frame up to k
+    for (unsigned int f = k - k % header.keyInterval; f <= k; f++)
+    {
+        const FramesEntry& entry = index[f];
+        if (entry.offset > footer.indexOffset || entry.size > footer.indexOffset - entry.offset ||
+            !rleDecode(data + entry.offset, entry.size, (unsigned char*)delta.data(), bytes))
+        {
+            std::cerr << "error reading " << filePath << ": frame " << f << " is corrupt" << std::endl;
+            return false;
+        }
+        for (size_t i = 0; i < delta.size(); i++) bitCells[i] ^= delta[i];
+    }
+    if (crc32((const unsigned char*)bitCells, bytes) != index[k].checksum)
+    {
+        std::cerr << "error reading " << filePath << ": frame " << k << " is corrupt" << std::endl;
+        return false;
+    }
+
+    board_generation = index[k].generation;
+    if (debugOutput) std::cout << "frame " << k << " of " << footer.frameCount << ", generation " << board_generation << std::endl;
+    return true;
+}
+
+// --extract-frame: saves frame k of the stream to fileO
+void runExtractFrame(const char* filePath, unsigned int k, const char* fileO)
+{
+    Timing::getInstance()->startSetup();
+    if (!loadFrame(filePath, k)) exit(EXIT_FAILURE);
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startFinalization();
+    saveBoard(fileO, LAYOUT_BITS);
+    Timing::getInstance()->stopFinalization();
+}
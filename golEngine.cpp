@@ -0,0 +1,479 @@
+#include "golEngine.h"
+#include "golStep.h" // stepCells, the same cell update as the modes
+#include "rule.h" // withRule, parseRule
+#include "oclProgram.h" // oclBuild, the same build and binary cache as ocl mode
+
+#include "omp.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define GOL_HUGE_PAGE (2 << 20) // mapped blocks are rounded up to whole huge pages
+
+namespace gol
+{
+
+// ---------------------------------------------------------------------------
+// arena
+
+Arena::Arena(bool hugePages) : mHugePages(hugePages)
+{
+}
+
+Arena::~Arena()
+{
+    // blocks still used by boards are freed with the arena, the boards must not outlive it
+    for (const Block& block : mBlocks) freeBlock(block);
+}
+
+unsigned char* Arena::allocate(size_t size)
+{
+    size = (size + GOL_ALIGNMENT - 1) / GOL_ALIGNMENT * GOL_ALIGNMENT;
+    if (size == 0) size = GOL_ALIGNMENT;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    // smallest released block that fits
+    Block* best = 0;
+    for (Block& block : mBlocks)
+    {
+        if (!block.used && block.size >= size && (best == 0 || block.size < best->size)) best = &block;
+    }
+    if (best != 0)
+    {
+        best->used = true;
+        return best->data;
+    }
+
+    Block block = { 0, size, false, true };
+#ifdef __linux__
+    if (mHugePages)
+    {
+        size_t mappedSize = (size + GOL_HUGE_PAGE - 1) / GOL_HUGE_PAGE * GOL_HUGE_PAGE;
+        void* data = mmap(0, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            block = { (unsigned char*)data, mappedSize, true, true };
+        }
+    }
+#endif
+    if (block.data == 0)
+    {
+#ifdef _WIN32
+        block.data = (unsigned char*)_aligned_malloc(size, GOL_ALIGNMENT);
+#else
+        if (mHugePages && size >= GOL_HUGE_PAGE)
+        {
+            // no reserved huge pages, transparent huge pages need the block aligned to them
+            size = (size + GOL_HUGE_PAGE - 1) / GOL_HUGE_PAGE * GOL_HUGE_PAGE;
+            block.size = size;
+            block.data = (unsigned char*)std::aligned_alloc(GOL_HUGE_PAGE, size);
+#ifdef __linux__
+            if (block.data != 0) madvise(block.data, size, MADV_HUGEPAGE);
+#endif
+        }
+        else block.data = (unsigned char*)std::aligned_alloc(GOL_ALIGNMENT, size);
+#endif
+        if (block.data == 0) return 0;
+    }
+    mBlocks.push_back(block);
+    return block.data;
+}
+
+void Arena::release(unsigned char* data)
+{
+    if (data == 0) return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (Block& block : mBlocks)
+    {
+        if (block.data == data)
+        {
+            block.used = false;
+            return;
+        }
+    }
+}
+
+void Arena::trim()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<Block> used;
+    for (const Block& block : mBlocks)
+    {
+        if (block.used) used.push_back(block);
+        else freeBlock(block);
+    }
+    mBlocks.swap(used);
+}
+
+void Arena::freeBlock(const Block& block)
+{
+#ifdef __linux__
+    if (block.mapped)
+    {
+        munmap(block.data, block.size);
+        return;
+    }
+#endif
+#ifdef _WIN32
+    _aligned_free(block.data);
+#else
+    std::free(block.data);
+#endif
+}
+
+Arena& defaultArena()
+{
+    static Arena arena;
+    return arena;
+}
+
+// ---------------------------------------------------------------------------
+// buffer
+
+Buffer::Buffer(Arena& arena, size_t size) : mArena(&arena), mData(arena.allocate(size)), mSize(mData != 0 ? size : 0)
+{
+}
+
+Buffer::~Buffer()
+{
+    if (mArena != 0) mArena->release(mData);
+}
+
+Buffer::Buffer(Buffer&& other) noexcept : mArena(other.mArena), mData(other.mData), mSize(other.mSize)
+{
+    other.mArena = 0;
+    other.mData = 0;
+    other.mSize = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (mArena != 0) mArena->release(mData);
+        mArena = other.mArena;
+        mData = other.mData;
+        mSize = other.mSize;
+        other.mArena = 0;
+        other.mData = 0;
+        other.mSize = 0;
+    }
+    return *this;
+}
+
+// ---------------------------------------------------------------------------
+// board
+
+Board::Board(unsigned int width, unsigned int height, Arena& arena) :
+    mWidth(width), mHeight(height), mFront(arena, (size_t)width * height), mBack(arena, (size_t)width * height)
+{
+    if (!valid()) std::cerr << "error allocating board of " << width << " x " << height << std::endl;
+    else memset(mFront.data(), 0, size());
+}
+
+Board::~Board()
+{
+    if (mDevice != 0) mDevice->forget(*this);
+}
+
+void Board::sync() const
+{
+    if (mDevice != 0) mDevice->download(*this);
+}
+
+void Board::own()
+{
+    sync();
+    if (mDevice != 0) mDevice->forget(*this);
+}
+
+void Board::load(const unsigned char* cells)
+{
+    own();
+    if (!valid()) return;
+    unsigned char* dst = mFront.data();
+    for (size_t i = 0; i < size(); i++) dst[i] = cells[i] != 0;
+    mGeneration = 0;
+}
+
+void Board::snapshot(unsigned char* cells) const
+{
+    sync();
+    if (valid()) memcpy(cells, mFront.data(), size());
+}
+
+bool Board::get(unsigned int x, unsigned int y) const
+{
+    sync();
+    return mFront.data()[(size_t)y * mWidth + x] != 0;
+}
+
+void Board::set(unsigned int x, unsigned int y, bool alive)
+{
+    own();
+    mFront.data()[(size_t)y * mWidth + x] = alive;
+}
+
+// ---------------------------------------------------------------------------
+// rules
+
+// the same masks as the Rule of rule.h, which the stepping code of the modes takes
+static ::Rule modeRule(const Rule& rule)
+{
+    return { rule.birth, rule.survive };
+}
+
+bool parseRule(const std::string& text, Rule& rule)
+{
+    ::Rule parsed;
+    if (!::parseRule(text, parsed)) return false;
+    rule = { parsed.birth, parsed.survive };
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// engines
+
+void Engine::claim(Board& board)
+{
+    if (board.mDevice != this) board.own();
+    board.mDevice = this;
+}
+
+class SeqEngine : public Engine
+{
+public:
+    explicit SeqEngine(const Rule& rule) : mRule(modeRule(rule)) {}
+
+    const char* name() const override { return "seq"; }
+
+    void step(Board& board, unsigned int generations) override
+    {
+        host(board);
+        if (!board.valid()) return;
+        withRule(mRule, [&](auto r)
+        {
+            for (unsigned int i = 0; i < generations; i++)
+            {
+                for (int row = 0; row < (int)board.height(); row++)
+                {
+                    stepCells(front(board), back(board), board.width(), board.height(), row, 0, (int)board.width(), r);
+                }
+                swap(board);
+            }
+        });
+    }
+
+private:
+    ::Rule mRule;
+};
+
+class OmpEngine : public Engine
+{
+public:
+    OmpEngine(int threads, const Rule& rule) : mThreads(threads > 0 ? threads : omp_get_max_threads()), mRule(modeRule(rule)) {}
+
+    const char* name() const override { return "omp"; }
+
+    void step(Board& board, unsigned int generations) override
+    {
+        host(board);
+        if (!board.valid() || generations == 0) return;
+        withRule(mRule, [&](auto r) { run(board, generations, r); });
+    }
+
+private:
+    template <typename R>
+    void run(Board& board, unsigned int generations, const R& rule)
+    {
+        // one parallel region for all generations, the barriers of for and single separate them
+#pragma omp parallel num_threads(mThreads)
+        for (unsigned int i = 0; i < generations; i++)
+        {
+            const unsigned char* src = front(board);
+            unsigned char* dst = back(board);
+#pragma omp for schedule(static)
+            for (int row = 0; row < (int)board.height(); row++)
+            {
+                stepCells(src, dst, board.width(), board.height(), row, 0, (int)board.width(), rule);
+            }
+#pragma omp single
+            swap(board);
+        }
+    }
+
+    int mThreads;
+    ::Rule mRule;
+};
+
+// context, program and queue per engine, two buffers per board ping-ponged like oclMode
+class OclEngine : public Engine
+{
+public:
+    ~OclEngine()
+    {
+        // boards keep the generations calculated on the device
+        for (auto& entry : mBoards)
+        {
+            download(*entry.first);
+            unclaim(*entry.first);
+        }
+    }
+
+    bool init(unsigned int platformId, unsigned int deviceId, const std::string& kernelFile, const Rule& rule, const std::string& cacheDir)
+    {
+        try
+        {
+            std::vector<cl::Platform> platforms;
+            cl::Platform::get(&platforms);
+            if (platformId >= platforms.size())
+            {
+                std::cerr << "specified OpenCL platform not available!" << std::endl;
+                return false;
+            }
+            std::vector<cl::Device> devices;
+            platforms[platformId].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+            if (deviceId >= devices.size())
+            {
+                std::cerr << "specified OpenCL device not available!" << std::endl;
+                return false;
+            }
+            mDevice = devices[deviceId];
+            mContext = cl::Context({ mDevice });
+            cl::Platform platform = platforms[platformId];
+
+            std::ifstream sourceFile(kernelFile);
+            if (!sourceFile)
+            {
+                std::cerr << "kernel source file " << kernelFile << " not found!" << std::endl;
+                return false;
+            }
+            std::string sourceCode(
+                std::istreambuf_iterator<char>(sourceFile),
+                (std::istreambuf_iterator<char>()));
+            bool hit = false;
+            mProgram = oclBuild(mContext, platform, mDevice, sourceCode, oclOptions(modeRule(rule)), cacheDir, hit);
+            mQueue = cl::CommandQueue(mContext, mDevice);
+        }
+        catch (cl::Error& err)
+        {
+            std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const char* name() const override { return "ocl"; }
+
+    void step(Board& board, unsigned int generations) override
+    {
+        if (!board.valid() || generations == 0) return;
+        try
+        {
+            if (!claimed(board)) upload(board);
+            Device& device = mBoards[&board];
+            for (unsigned int i = 0; i < generations; i++)
+            {
+                mQueue.enqueueNDRangeKernel(device.kernels[device.current], cl::NullRange, cl::NDRange(board.size()), cl::NullRange);
+                device.current ^= 1;
+            }
+            device.downloaded = false;
+            advance(board, generations);
+        }
+        catch (cl::Error& err)
+        {
+            std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+        }
+    }
+
+private:
+    struct Device
+    {
+        cl::Buffer buffers[2];
+        cl::Kernel kernels[2];  // [i] reads buffers[i] and writes the other one
+        int current = 0;        // buffer holding the board
+        bool downloaded = true; // host cells are up to date
+    };
+
+    void upload(Board& board)
+    {
+        claim(board);
+        Device& device = mBoards[&board];
+        for (int i = 0; i < 2; i++) device.buffers[i] = cl::Buffer(mContext, CL_MEM_READ_WRITE, board.size());
+        for (int i = 0; i < 2; i++)
+        {
+            device.kernels[i] = cl::Kernel(mProgram, "gol_generation");
+            device.kernels[i].setArg(0, device.buffers[i]);
+            device.kernels[i].setArg(1, device.buffers[i ^ 1]);
+            device.kernels[i].setArg(2, board.width());
+            device.kernels[i].setArg(3, board.height());
+        }
+        mQueue.enqueueWriteBuffer(device.buffers[0], CL_TRUE, 0, board.size(), front(board));
+    }
+
+    void download(const Board& board) override
+    {
+        auto entry = mBoards.find(&board);
+        if (entry == mBoards.end() || entry->second.downloaded) return;
+        try
+        {
+            mQueue.enqueueReadBuffer(entry->second.buffers[entry->second.current], CL_TRUE, 0, board.size(), front(board));
+            entry->second.downloaded = true;
+        }
+        catch (cl::Error& err)
+        {
+            std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+        }
+    }
+
+    void forget(const Board& board) override
+    {
+        mBoards.erase(&board);
+        unclaim(board);
+    }
+
+    cl::Device mDevice;
+    cl::Context mContext;
+    cl::Program mProgram;
+    cl::CommandQueue mQueue;
+    std::map<const Board*, Device> mBoards;
+};
+
+std::unique_ptr<Engine> makeSeqEngine(const Rule& rule)
+{
+    return std::unique_ptr<Engine>(new SeqEngine(rule));
+}
+
+std::unique_ptr<Engine> makeOmpEngine(int threads, const Rule& rule)
+{
+    return std::unique_ptr<Engine>(new OmpEngine(threads, rule));
+}
+
+std::unique_ptr<Engine> makeOclEngine(unsigned int platformId, unsigned int deviceId, const std::string& kernelFile,
+    const Rule& rule, const std::string& cacheDir)
+{
+    std::unique_ptr<OclEngine> engine(new OclEngine());
+    if (!engine->init(platformId, deviceId, kernelFile, rule, cacheDir)) return 0;
+    return std::unique_ptr<Engine>(engine.release());
+}
+
+std::unique_ptr<Engine> makeEngine(const std::string& name, int threads, const Rule& rule)
+{
+    if (name == "seq") return makeSeqEngine(rule);
+    if (name == "omp") return makeOmpEngine(threads, rule);
+    if (name == "ocl") return makeOclEngine(0, 0, "kernel.cl", rule);
+    std::cerr << "unknown engine " << name << ", possible values are seq, omp, ocl" << std::endl;
+    return 0;
+}
+
+} // namespace gol
@@ -0,0 +1,215 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+engine library (make libsimoflife.a):
+the modes of SimOfLife work on the globals of common.h and read and write
+files, so they can only run one board per process. the library runs boards
+of byte cells for other programs, every board owns its state and nothing
+touches the file system:
+
+    gol::Board board(width, height);
+    board.load(cells);                          // width * height bytes, != 0 is alive
+    std::unique_ptr<gol::Engine> engine = gol::makeEngine("omp");
+    engine->step(board, 100);
+    engine->snapshot(board, cells);
+
+buffers of a board come from an Arena, 64 byte aligned and padded to whole
+cache lines. a board returns its buffers to the arena when it is destroyed,
+so the next board of the same size reuses them and running many boards does
+not allocate per run. an arena created with hugePages backs its blocks with
+huge pages (linux, MAP_HUGETLB, else transparent huge pages are advised),
+falling back to normal pages if none are available.
+
+engines (backends) implement Engine:
+    seq     one thread
+    omp     OpenMP threads, rows are split between them
+    ocl     OpenCL gol_generation of kernel.cl, the board stays on the device
+            between steps and is only read back by snapshot / get
+an engine may be used for any number of boards, but one board only with one
+engine at a time, every engine runs the rule it was made with (conway by
+default). only gol::Rule is exposed, the rule code of the modes (rule.h) and
+their --rule global stay out of programs using the library.
+
+scope: the library does not replace the globals, the modes do not run
+through it and it has no bits / simd / lut / sparse / hashlife engines or
+the tiled ocl kernel. it shares the stepping code with the modes instead of
+having its own: seq and omp step rows with stepCells (golStep.h) like
+ompCells, ocl builds kernel.cl with the rule options and binary cache of ocl
+mode (oclProgram.h). boards wrap around at the borders like in the modes.
+
+--------------------------------------------------------------------------- */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define GOL_ALIGNMENT 64 // cache line, blocks of an arena start and end on one
+
+namespace gol
+{
+
+// life-like rule, bit n set: a cell with n alive neighbours is born / survives
+struct Rule
+{
+    uint16_t birth;
+    uint16_t survive;
+};
+
+const Rule CONWAY = { 1 << 3, (1 << 2) | (1 << 3) }; // B3/S23
+
+// parses "B3/S23" or "23/3" (survive / birth), returns false if malformed
+bool parseRule(const std::string& text, Rule& rule);
+
+// hands out aligned blocks and keeps released ones for reuse, thread safe
+class Arena
+{
+public:
+    explicit Arena(bool hugePages = false);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // block of at least size bytes, 0 if out of memory
+    unsigned char* allocate(size_t size);
+    // gives a block of allocate back, it is reused by the next allocate that fits
+    void release(unsigned char* block);
+    // frees all released blocks
+    void trim();
+
+    bool hugePages() const { return mHugePages; }
+
+private:
+    struct Block
+    {
+        unsigned char* data;
+        size_t size;
+        bool mapped;    // mmap'ed huge pages instead of an aligned allocation
+        bool used;
+    };
+
+    void freeBlock(const Block& block);
+
+    bool mHugePages;
+    std::mutex mMutex;
+    std::vector<Block> mBlocks;
+};
+
+// arena of all boards which are not given one
+Arena& defaultArena();
+
+// aligned block of an arena, released when it goes out of scope
+class Buffer
+{
+public:
+    Buffer() {}
+    Buffer(Arena& arena, size_t size);
+    ~Buffer();
+    Buffer(Buffer&& other) noexcept;
+    Buffer& operator=(Buffer&& other) noexcept;
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    unsigned char* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    Arena* mArena = 0;
+    unsigned char* mData = 0;
+    size_t mSize = 0;
+};
+
+class Engine;
+
+// one board, cells are bytes (0 dead, 1 alive) with a second buffer for the next generation
+class Board
+{
+public:
+    Board(unsigned int width, unsigned int height, Arena& arena = defaultArena());
+    ~Board();
+    Board(const Board&) = delete;
+    Board& operator=(const Board&) = delete;
+
+    // copies width * height bytes (!= 0 is alive) into the board, generation 0
+    void load(const unsigned char* cells);
+    // copies the board into width * height bytes (0 / 1)
+    void snapshot(unsigned char* cells) const;
+    bool get(unsigned int x, unsigned int y) const;
+    void set(unsigned int x, unsigned int y, bool alive);
+
+    unsigned int width() const { return mWidth; }
+    unsigned int height() const { return mHeight; }
+    size_t size() const { return (size_t)mWidth * mHeight; }
+    uint64_t generation() const { return mGeneration; }
+    // false if the buffers could not be allocated
+    bool valid() const { return mFront.data() != 0 && mBack.data() != 0; }
+
+private:
+    friend class Engine;
+
+    // an engine holding the board on its device writes it back to mFront
+    void sync() const;
+    // and drops its copy, the host cells are changed next
+    void own();
+
+    unsigned int mWidth;
+    unsigned int mHeight;
+    uint64_t mGeneration = 0;
+    Buffer mFront;      // current generation
+    Buffer mBack;       // next generation while an engine calculates it
+    mutable Engine* mDevice = 0;
+};
+
+// backend interface of the engines
+class Engine
+{
+public:
+    virtual ~Engine() {}
+    virtual const char* name() const = 0;
+
+    // advances the board by generations
+    virtual void step(Board& board, unsigned int generations) = 0;
+
+    // same as Board::load / snapshot
+    void load(Board& board, const unsigned char* cells) { board.load(cells); }
+    void snapshot(const Board& board, unsigned char* cells) const { board.snapshot(cells); }
+
+protected:
+    // for engines calculating on the host cells: takes the board back from a device
+    static void host(Board& board) { board.own(); }
+    // for engines with a device: takes the board over from another engine
+    void claim(Board& board);
+    bool claimed(const Board& board) const { return board.mDevice == this; }
+    // the board is no longer held by this engine
+    void unclaim(const Board& board) { if (board.mDevice == this) board.mDevice = 0; }
+
+    static unsigned char* front(const Board& board) { return board.mFront.data(); }
+    static unsigned char* back(const Board& board) { return board.mBack.data(); }
+    // next generation is in back, makes it the current one
+    static void swap(Board& board) { std::swap(board.mFront, board.mBack); board.mGeneration++; }
+    // generations were calculated on a device
+    static void advance(Board& board, uint64_t generations) { board.mGeneration += generations; }
+
+private:
+    friend class Board;
+
+    // writes the board back to its host cells (engines with a device)
+    virtual void download(const Board& board) { (void)board; }
+    // drops what the engine keeps of the board, it is changed on the host or destroyed
+    virtual void forget(const Board& board) { unclaim(board); }
+};
+
+std::unique_ptr<Engine> makeSeqEngine(const Rule& rule = CONWAY);
+// threads <= 0 uses the OpenMP default
+std::unique_ptr<Engine> makeOmpEngine(int threads = 0, const Rule& rule = CONWAY);
+// 0 and a message on cerr if the platform / device is not available or kernelFile does not build,
+// built programs are cached in cacheDir ("" disables) like in ocl mode
+std::unique_ptr<Engine> makeOclEngine(unsigned int platformId = 0, unsigned int deviceId = 0, const std::string& kernelFile = "kernel.cl",
+    const Rule& rule = CONWAY, const std::string& cacheDir = "oclcache");
+// "seq", "omp" or "ocl" with the defaults above, 0 for other names
+std::unique_ptr<Engine> makeEngine(const std::string& name, int threads = 0, const Rule& rule = CONWAY);
+
+} // namespace gol
@@ -0,0 +1,513 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+gol file io:
+one loader for all modes. the file is mapped into memory instead of being
+parsed line by line with std::getline, the row starts are located in
+parallel (each thread counts the newlines of its chunk, then the chunks are
+stitched together by prefix sums) and the rows are converted in parallel
+into the layout the mode works on:
+    LAYOUT_BYTES    one byte per cell, 0 dead / 1 alive (omp, ocl, ...)
+    LAYOUT_SEQ      one byte per cell, alive bit + neighbour count (seq)
+    LAYOUT_BITS     one bit per cell, 64 cells per word (bits)
+
+every row must have exactly w cells (a trailing '\r' is ignored), otherwise
+the file is reported as malformed and nothing is loaded. the loaders fill a
+BoardView and do not touch the globals, useBoard() makes it the current
+board, so a board can be loaded on another thread (--batch).
+
+the writer formats rows in parallel, 8 cells per step: bytes are expanded to
+chars with one multiply-add on a uint64_t, bit packed rows through a table of
+256 precalculated 8 char strings. the formatted bands are written with pwrite
+at their final offsets, so no thread waits for another.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "omp.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GOLIO_SSE2
+#include <emmintrin.h>
+#endif
+
+enum GolLayout
+{
+    LAYOUT_BYTES,
+    LAYOUT_SEQ,
+    LAYOUT_BITS
+};
+
+// read only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    bool open(const char* filePath)
+    {
+        close();
+#ifdef _WIN32
+        mFile = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mFile == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(mFile, &size);
+        mSize = (size_t)size.QuadPart;
+        if (mSize == 0) return true;
+
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mMapping == NULL) return false;
+        mData = (const char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        mFd = ::open(filePath, O_RDONLY);
+        if (mFd < 0) return false;
+
+        struct stat st;
+        if (fstat(mFd, &st) != 0) return false;
+        mSize = (size_t)st.st_size;
+        if (mSize == 0) return true;
+
+        void* data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+        if (data == MAP_FAILED) return false;
+        madvise(data, mSize, MADV_WILLNEED);
+        mData = (const char*)data;
+#endif
+        return mData != 0;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (mData) UnmapViewOfFile(mData);
+        if (mMapping != NULL) CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+        mMapping = NULL;
+        mFile = INVALID_HANDLE_VALUE;
+#else
+        if (mData) munmap((void*)mData, mSize);
+        if (mFd >= 0) ::close(mFd);
+        mFd = -1;
+#endif
+        mData = 0;
+        mSize = 0;
+    }
+
+    const char* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* mData = 0;
+    size_t mSize = 0;
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = NULL;
+#else
+    int mFd = -1;
+#endif
+};
+
+// sets w, h and all values derived from them
+void setDimensions(unsigned int width, unsigned int height)
+{
+    w = width;
+    h = height;
+    total_elem_count = w * h;
+    col_right = w - 1;
+    col_bot = total_elem_count - w;
+    row_bot = h - 1;
+    words_per_row = (w + 63) / 64;
+    if (debugOutput) std::cout << "total: " << total_elem_count << ", w: " << w << ", h: " << h << std::endl;
+    if (debugOutput) std::cout << "col_right: " << col_right << ", col_bot: " << col_bot << ", row_bot: " << row_bot << std::endl;
+}
+
+// makes a loaded board the current one, the globals take over its cells
+void useBoard(const BoardView& board)
+{
+    setDimensions(board.w, board.h);
+    cells = const_cast<unsigned char*>(board.cells);
+    bitCells = const_cast<uint64_t*>(board.bitCells);
+    board_generation = board.generation;
+}
+
+// empty board of the size with the derived words_per_row, cells are allocated by the loaders
+inline BoardView emptyBoard(unsigned int width, unsigned int height, uint64_t generation = 0)
+{
+    return { width, height, (width + 63) / 64, 0, 0, generation };
+}
+
+// parses "w,h" at the start of data, returns offset of the first row or 0 if malformed
+size_t parseGolHeader(const char* data, size_t size, unsigned int& width, unsigned int& height)
+{
+    const char* end = (const char*)memchr(data, '\n', size);
+    if (end == 0) return 0;
+
+    std::string line(data, end - data);
+    size_t pos = line.find(',');
+    if (pos == std::string::npos) return 0;
+
+    try
+    {
+        width = std::stoul(line.substr(0, pos));
+        height = std::stoul(line.substr(pos + 1));
+    }
+    catch (const std::exception&)
+    {
+        return 0;
+    }
+    if (width == 0 || height == 0) return 0;
+
+    return end - data + 1;
+}
+
+// finds the start of the first height rows in [begin, size), in parallel.
+// rowStart[y + 1] - 1 is the newline ending row y, returns the number of newlines
+size_t findRowStarts(const char* data, size_t begin, size_t size, unsigned int height, std::vector<size_t>& rowStart)
+{
+    int chunks = omp_get_max_threads() * 4;
+    size_t chunkLen = (size - begin + chunks - 1) / chunks;
+    std::vector<size_t> counts(chunks + 1, 0);
+
+    int c;
+#pragma omp parallel for schedule(static)
+    for (c = 0; c < chunks; c++)
+    {
+        size_t from = std::min(begin + c * chunkLen, size);
+        size_t to = std::min(from + chunkLen, size);
+        size_t count = 0;
+        const char* p = data + from;
+        while ((p = (const char*)memchr(p, '\n', data + to - p)) != 0)
+        {
+            count++;
+            p++;
+        }
+        counts[c + 1] = count;
+    }
+
+    for (c = 0; c < chunks; c++) counts[c + 1] += counts[c];
+
+    rowStart.assign((size_t)height + 1, size);
+    rowStart[0] = begin;
+#pragma omp parallel for schedule(static)
+    for (c = 0; c < chunks; c++)
+    {
+        if (counts[c] >= height) continue;
+
+        size_t from = std::min(begin + c * chunkLen, size);
+        size_t to = std::min(from + chunkLen, size);
+        size_t line = counts[c];
+        const char* p = data + from;
+        while (line < height && (p = (const char*)memchr(p, '\n', data + to - p)) != 0)
+        {
+            rowStart[++line] = ++p - data;
+        }
+    }
+
+    return counts[chunks];
+}
+
+// converts one row of 'x' / '.' to 0 / 1 bytes
+inline void convertRowBytes(const char* src, unsigned char* dst, unsigned int width)
+{
+    unsigned int x = 0;
+#ifdef GOLIO_SSE2
+    const __m128i alive = _mm_set1_epi8('x');
+    const __m128i one = _mm_set1_epi8(1);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(src + x));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_and_si128(_mm_cmpeq_epi8(chars, alive), one));
+    }
+#endif
+    for (; x < width; x++) dst[x] = (src[x] == 'x');
+}
+
+// converts one row of 'x' / '.' to bit packed words
+inline void convertRowBits(const char* src, uint64_t* dst, unsigned int width)
+{
+    unsigned int words = (width + 63) / 64;
+    for (unsigned int k = 0; k < words; k++)
+    {
+        unsigned int x = k * 64;
+        unsigned int end = std::min(x + 64, width);
+        uint64_t word = 0;
+#ifdef GOLIO_SSE2
+        const __m128i alive = _mm_set1_epi8('x');
+        for (; x + 16 <= end; x += 16)
+        {
+            __m128i chars = _mm_loadu_si128((const __m128i*)(src + x));
+            word |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(chars, alive)) << (x % 64);
+        }
+#endif
+        for (; x < end; x++) word |= (uint64_t)(src[x] == 'x') << (x % 64);
+        dst[k] = word;
+    }
+}
+
+// adds the neighbour counts of the seq layout to a 0 / 1 byte board of width x height
+void encodeNeighbours(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int height)
+{
+    int lastRow = (int)height - 1;
+    int lastCol = (int)width - 1;
+    int row;
+#pragma omp parallel for schedule(static)
+    for (row = 0; row <= lastRow; row++)
+    {
+        const unsigned char* up = src + (size_t)((row == 0) ? lastRow : row - 1) * width;
+        const unsigned char* cur = src + (size_t)row * width;
+        const unsigned char* down = src + (size_t)((row == lastRow) ? 0 : row + 1) * width;
+        for (int col = 0; col <= lastCol; col++)
+        {
+            int left = (col == 0) ? lastCol : col - 1;
+            int right = (col == lastCol) ? 0 : col + 1;
+            int countNeighbours = up[left] + up[col] + up[right] + cur[left] + cur[right] + down[left] + down[col] + down[right];
+            dst[(size_t)row * width + col] = cur[col] | (countNeighbours << 1);
+        }
+    }
+}
+
+// toggles the cell at (x, y) of the seq layout and updates the neighbour counts around it
+inline void setCellState(unsigned char* ptr_cell, unsigned int x, unsigned int y, bool alive = true)
+{
+    // set cell value
+    *(ptr_cell) ^= STATE_ALIVE; // just toggle -> no if, saves about 500 ms
+
+    // calculate neighbours -> wrap-around at borders: { 0, 0 } is a neighbor of { m, n } on a m x n sized grid
+    // offsets in x,y direction
+#ifdef NO_IFS
+    int xOffLeft = col_right * (x == 0) + -1 * (x != 0);
+    int xOffRight = (-col_right * (x == col_right)) + 1 * (x != col_right);
+    int yOffTop = col_bot * (y == 0) + (-(int)w * (y != 0));
+    int yOffBot = (y == (h - 1)) ? -col_bot : w; // need to cast to int because of negative sign
+#else
+    int xOffLeft = (x == 0) ? col_right : -1;
+    int xOffRight = (x == col_right) ? -col_right : 1;
+    int yOffTop = (y == 0) ? col_bot : -(int)w;
+    int yOffBot = (y == (h - 1)) ? -col_bot : w; // need to cast to int because of negative sign
+#endif
+
+    // add bits for neighbour counts -> performs a diff!
+    int val = (alive) * 0x02 + (!alive) * -0x02;
+    *(ptr_cell + yOffTop + xOffLeft) += val;
+    *(ptr_cell + yOffTop) += val;
+    *(ptr_cell + yOffTop + xOffRight) += val;
+    *(ptr_cell + xOffLeft) += val;
+    *(ptr_cell + xOffRight) += val;
+    *(ptr_cell + yOffBot + xOffLeft) += val;
+    *(ptr_cell + yOffBot) += val;
+    *(ptr_cell + yOffBot + xOffRight) += val;
+}
+
+// loads a .gol file into board.cells (bytes, seq) or board.bitCells (bits).
+// returns false and reports the reason if the file can not be read or is malformed
+bool loadGol(const char* filePath, GolLayout layout, BoardView& board)
+{
+    if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
+    MappedFile file;
+    if (!file.open(filePath))
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+
+    const char* data = file.data();
+    size_t size = file.size();
+    unsigned int width = 0;
+    unsigned int height = 0;
+    size_t begin = (size > 0) ? parseGolHeader(data, size, width, height) : 0;
+    if (begin == 0)
+    {
+        std::cerr << "error reading " << filePath << ": missing or malformed \"w,h\" header" << std::endl;
+        return false;
+    }
+
+    std::vector<size_t> rowStart;
+    size_t newlines = findRowStarts(data, begin, size, height, rowStart);
+    size_t rows = newlines + (size > 0 && data[size - 1] != '\n'); // last row may lack the newline
+    if (rows < height)
+    {
+        std::cerr << "error reading " << filePath << ": expected " << height << " rows, found " << rows << std::endl;
+        return false;
+    }
+
+    // check all row lengths before touching the board
+    int badRow = -1;
+    int y;
+#pragma omp parallel for schedule(static)
+    for (y = 0; y < (int)height; y++)
+    {
+        size_t end = ((size_t)y < newlines) ? rowStart[y + 1] - 1 : size;
+        if (end > rowStart[y] && data[end - 1] == '\r') end--;
+        if (end - rowStart[y] != width)
+        {
+#pragma omp critical
+            if (badRow < 0 || y < badRow) badRow = y;
+        }
+    }
+    if (badRow >= 0)
+    {
+        size_t end = ((size_t)badRow < newlines) ? rowStart[badRow + 1] - 1 : size;
+        std::cerr << "error reading " << filePath << ": row " << badRow << " has " << (end - rowStart[badRow])
+            << " cells, expected " << width << std::endl;
+        return false;
+    }
+
+    board = emptyBoard(width, height);
+    size_t count = (size_t)width * height;
+
+    if (layout == LAYOUT_BITS)
+    {
+        uint64_t* bits = new uint64_t[(size_t)board.words_per_row * height];
+#pragma omp parallel for schedule(static)
+        for (y = 0; y < (int)height; y++)
+        {
+            convertRowBits(data + rowStart[y], bits + (size_t)y * board.words_per_row, width);
+        }
+        board.bitCells = bits;
+        return true;
+    }
+
+    unsigned char* bytes = new unsigned char[count];
+#pragma omp parallel for schedule(static)
+    for (y = 0; y < (int)height; y++)
+    {
+        convertRowBytes(data + rowStart[y], bytes + (size_t)y * width, width);
+    }
+
+    if (layout == LAYOUT_SEQ)
+    {
+        unsigned char* encoded = new unsigned char[count];
+        encodeNeighbours(bytes, encoded, width, height);
+        delete[] bytes;
+        bytes = encoded;
+    }
+    board.cells = bytes;
+
+    return true;
+}
+
+// formats 8 cells from bytes (only the alive bit is used) to 8 chars at once:
+// '.' is 0x2E, 'x' is 0x78 = 0x2E + 0x4A, no byte can overflow into the next
+inline uint64_t expandBytes(uint64_t bytes)
+{
+    return 0x2E2E2E2E2E2E2E2EULL + (bytes & 0x0101010101010101ULL) * 0x4A;
+}
+
+// 8 chars for every possible byte of a bit packed row
+struct ExpandTable
+{
+    uint64_t chars[256];
+    ExpandTable()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint64_t bytes = 0;
+            for (int bit = 0; bit < 8; bit++) bytes |= (uint64_t)((i >> bit) & 1) << (bit * 8);
+            chars[i] = expandBytes(bytes);
+        }
+    }
+};
+
+// writes row y of board as text (without newline)
+inline void formatRow(char* dst, const BoardView& board, unsigned int y, GolLayout layout)
+{
+    static const ExpandTable table;
+    unsigned int x = 0;
+    uint64_t chars;
+    if (layout == LAYOUT_BITS)
+    {
+        const unsigned char* bytes = (const unsigned char*)(board.bitCells + (size_t)y * board.words_per_row); // little endian
+        for (; x + 8 <= board.w; x += 8)
+        {
+            chars = table.chars[bytes[x / 8]];
+            memcpy(dst + x, &chars, 8);
+        }
+        for (; x < board.w; x++) dst[x] = ((board.bitCells[(size_t)y * board.words_per_row + x / 64] >> (x % 64)) & 1) ? 'x' : '.';
+    }
+    else
+    {
+        const unsigned char* row = board.cells + (size_t)y * board.w;
+        uint64_t bytes;
+        for (; x + 8 <= board.w; x += 8)
+        {
+            memcpy(&bytes, row + x, 8);
+            chars = expandBytes(bytes);
+            memcpy(dst + x, &chars, 8);
+        }
+        for (; x < board.w; x++) dst[x] = (row[x] & STATE_ALIVE) ? 'x' : '.';
+    }
+}
+
+// writes board as .gol text. rows are formatted in parallel in bands,
+// on posix every band is written with its own pwrite at its final offset
+bool writeGol(const char* filePath, GolLayout layout, const BoardView& board)
+{
+    if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
+    std::string header = std::to_string(board.w) + "," + std::to_string(board.h) + "\n";
+    size_t rowLen = (size_t)board.w + 1;
+    bool ok = true;
+
+#ifdef _WIN32
+    size_t size = header.size() + rowLen * board.h;
+    std::vector<char> text(size);
+    memcpy(text.data(), header.data(), header.size());
+    int y;
+#pragma omp parallel for schedule(static)
+    for (y = 0; y < (int)board.h; y++)
+    {
+        char* dst = text.data() + header.size() + y * rowLen;
+        formatRow(dst, board, y, layout);
+        dst[board.w] = '\n';
+    }
+
+    FILE* out = fopen(filePath, "wb");
+    ok = out != 0 && fwrite(text.data(), 1, size, out) == size;
+    if (out != 0) ok = (fclose(out) == 0) && ok;
+#else
+    int fd = ::open(filePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    ok = pwrite(fd, header.data(), header.size(), 0) == (ssize_t)header.size();
+
+    int rowsPerBand = (int)std::max((size_t)1, ((size_t)4 << 20) / rowLen); // about 4 MB per band
+    int bands = ((int)board.h + rowsPerBand - 1) / rowsPerBand;
+    int band;
+#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (band = 0; band < bands; band++)
+    {
+        int y0 = band * rowsPerBand;
+        int y1 = std::min(y0 + rowsPerBand, (int)board.h);
+        std::vector<char> text(rowLen * (y1 - y0));
+        for (int y = y0; y < y1; y++)
+        {
+            char* dst = text.data() + (y - y0) * rowLen;
+            formatRow(dst, board, y, layout);
+            dst[board.w] = '\n';
+        }
+        off_t offset = (off_t)(header.size() + rowLen * y0);
+        ok = ok && pwrite(fd, text.data(), text.size(), offset) == (ssize_t)text.size();
+    }
+    ok = (::close(fd) == 0) && ok;
+#endif
+
+    if (!ok) std::cerr << "error writing " << filePath << std::endl;
+    return ok;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+stepping a byte board (0 dead / 1 alive per cell):
+the cell update of omp mode without the globals of common.h, the board size
+is passed in. ompCells (omp, simd, sparse, dist) and the seq / omp engines of
+the library (golEngine.h) both step their rows with stepCells, so they can
+not calculate different results.
+
+--------------------------------------------------------------------------- */
+
+#include <algorithm>
+
+inline int sumNeighbours(const unsigned char* ptr_cell, int yOffTop, int yOffBot, int xOffLeft, int xOffRight)
+{
+    // just return the sum of states for all neighbours
+    return
+        *(ptr_cell + yOffTop + xOffLeft) +
+        *(ptr_cell + yOffTop) +
+        *(ptr_cell + yOffTop + xOffRight) +
+        *(ptr_cell + xOffLeft) +
+        *(ptr_cell + xOffRight) +
+        *(ptr_cell + yOffBot + xOffLeft) +
+        *(ptr_cell + yOffBot) +
+        *(ptr_cell + yOffBot + xOffRight);
+}
+
+// calculates cells [from, to) of a row of a width x height board for the next generation
+// from src into dst, wrapping around the borders. returns != 0 if any of them changed
+template <typename R>
+inline unsigned char stepCells(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned int height,
+    int row, int from, int to, const R& rule)
+{
+    int right = (int)width - 1;
+    int bot = (int)(width * (height - 1)); // offset of the last row
+    int yOffTop = (row == 0) ? bot : -(int)width;
+    int yOffBot = (row == (int)height - 1) ? -bot : (int)width;
+    int idx = row * (int)width;
+    int countNeighbours = 0;
+    unsigned char diff = 0;
+    unsigned char next = 0;
+
+    // handle border for x == 0
+    if (from == 0)
+    {
+        countNeighbours = sumNeighbours(src + idx, yOffTop, yOffBot, right, (right == 0) ? 0 : 1);
+        next = rule.next(src[idx], countNeighbours);
+        diff |= next ^ src[idx];
+        dst[idx] = next;
+        from = 1;
+    }
+
+    int end = std::min(to, right);
+    for (int col = from; col < end; col++)
+    {
+        countNeighbours = sumNeighbours(src + idx + col, yOffTop, yOffBot, -1, 1);
+        next = rule.next(src[idx + col], countNeighbours);
+        diff |= next ^ src[idx + col];
+        dst[idx + col] = next;
+    }
+
+    // handle border for x == right
+    if (to > right && right > 0)
+    {
+        idx += right;
+        countNeighbours = sumNeighbours(src + idx, yOffTop, yOffBot, -1, -right);
+        next = rule.next(src[idx], countNeighbours);
+        diff |= next ^ src[idx];
+        dst[idx] = next;
+    }
+
+    return diff;
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+golb file io:
+compact binary snapshot format, selected by the extension ".golb".
+
+    header          64 bytes, see GolbHeader (little endian)
+    block table     one GolbBlock per block
+    payload         the blocks, each holding rowsPerBlock bit packed rows
+
+rows are stored in the bits layout (words_per_row little endian uint64_t per
+row, see common.h), so a bits board is loaded without any conversion. every
+block is either stored raw or compressed with a simple byte run length
+encoding (--compress), whatever is smaller, and carries a crc32 of its raw
+content which is verified on load. blocks are packed, checked and unpacked
+in parallel, the file is read through a memory mapping.
+
+besides the size the header stores the generation of the board and the
+rule it was simulated with, so a snapshot can be continued later.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "golIO.h" // MappedFile, emptyBoard, encodeNeighbours
+#include "rule.h"
+
+#define GOLB_MAGIC "GOLB"
+#define GOLB_VERSION 1
+#define GOLB_ROWS_PER_BLOCK 64
+
+#define GOLB_LAYOUT_BITS 1      // rows of 64 cells per little endian word
+
+#define GOLB_BLOCK_RAW 0
+#define GOLB_BLOCK_RLE 1
+
+struct GolbHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint64_t generation;
+    uint16_t birth;         // bit n set: a dead cell with n neighbours is born
+    uint16_t survive;       // bit n set: an alive cell with n neighbours survives
+    uint32_t layout;
+    uint32_t rowsPerBlock;
+    uint32_t blockCount;
+    uint8_t reserved[24];
+};
+
+struct GolbBlock
+{
+    uint64_t offset;        // from start of file
+    uint32_t size;          // stored bytes
+    uint32_t rawSize;       // bytes after decoding
+    uint32_t checksum;      // crc32 of the raw bytes
+    uint32_t encoding;
+};
+
+bool compressSnapshots = false; // --compress, rle compress .golb blocks
+
+// crc32 (ieee 802.3 polynomial), table driven
+struct Crc32Table
+{
+    uint32_t entries[256];
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const unsigned char* data, size_t size)
+{
+    static const Crc32Table table;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// run length encoding on bytes, a control byte c is followed by
+//      c < 128:  c + 1 literal bytes
+//      c >= 128: one byte repeated c - 126 times (2 ... 129)
+void rleEncode(const unsigned char* src, size_t size, std::vector<unsigned char>& dst)
+{
+    dst.clear();
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = 1;
+        while (i + run < size && run < 129 && src[i + run] == src[i]) run++;
+        if (run >= 2)
+        {
+            dst.push_back((unsigned char)(run + 126));
+            dst.push_back(src[i]);
+            i += run;
+            continue;
+        }
+
+        // literals until the next run of at least 2 equal bytes
+        size_t start = i;
+        while (i < size && i - start < 128 && !(i + 1 < size && src[i] == src[i + 1])) i++;
+        dst.push_back((unsigned char)(i - start - 1));
+        dst.insert(dst.end(), src + start, src + i);
+    }
+}
+
+// returns false if the encoded data does not decode to exactly size bytes
+bool rleDecode(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t size)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while (i < srcSize)
+    {
+        unsigned int c = src[i++];
+        if (c < 128)
+        {
+            size_t len = c + 1;
+            if (i + len > srcSize || o + len > size) return false;
+            memcpy(dst + o, src + i, len);
+            i += len;
+            o += len;
+        }
+        else
+        {
+            size_t len = c - 126;
+            if (i >= srcSize || o + len > size) return false;
+            memset(dst + o, src[i++], len);
+            o += len;
+        }
+    }
+    return o == size;
+}
+
+bool isGolbFile(const char* filePath)
+{
+    std::string path(filePath);
+    return path.size() >= 5 && path.compare(path.size() - 5, 5, ".golb") == 0;
+}
+
+// loads a .golb snapshot into board.cells (bytes, seq) or board.bitCells (bits) with its
+// generation. returns false and reports the reason if malformed or corrupt
+bool loadGolb(const char* filePath, GolLayout layout, BoardView& board)
+{
+    if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
+    MappedFile file;
+    if (!file.open(filePath))
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+
+    const unsigned char* data = (const unsigned char*)file.data();
+    size_t size = file.size();
+    GolbHeader header;
+    if (size < sizeof(header))
+    {
+        std::cerr << "error reading " << filePath << ": file too small" << std::endl;
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, GOLB_MAGIC, 4) != 0 || header.version != GOLB_VERSION || header.layout != GOLB_LAYOUT_BITS ||
+        header.width == 0 || header.height == 0 || header.rowsPerBlock == 0 ||
+        header.blockCount != (header.height + header.rowsPerBlock - 1) / header.rowsPerBlock ||
+        sizeof(header) + (size_t)header.blockCount * sizeof(GolbBlock) > size)
+    {
+        std::cerr << "error reading " << filePath << ": not a valid golb file" << std::endl;
+        return false;
+    }
+    Rule stored = { header.birth, header.survive };
+    if (stored != rule)
+    {
+        std::cerr << "warning: " << filePath << " was simulated with rule " << ruleString(stored) << ", continued with " << ruleString(rule) << std::endl;
+    }
+
+    std::vector<GolbBlock> blocks(header.blockCount);
+    memcpy(blocks.data(), data + sizeof(header), blocks.size() * sizeof(GolbBlock));
+
+    unsigned int width = header.width;
+    unsigned int height = header.height;
+    unsigned int words = (width + 63) / 64;
+    size_t rowBytes = (size_t)words * 8;
+
+    uint64_t* bits = new uint64_t[(size_t)words * height];
+    int badBlock = -1;
+    int b;
+#pragma omp parallel for schedule(dynamic)
+    for (b = 0; b < (int)blocks.size(); b++)
+    {
+        const GolbBlock& block = blocks[b];
+        unsigned int rows = std::min(header.rowsPerBlock, height - b * header.rowsPerBlock);
+        unsigned char* dst = (unsigned char*)(bits + (size_t)b * header.rowsPerBlock * words);
+        bool ok = block.rawSize == rows * rowBytes && block.offset <= size && block.size <= size - block.offset;
+        if (ok && block.encoding == GOLB_BLOCK_RAW)
+        {
+            ok = block.size == block.rawSize;
+            if (ok) memcpy(dst, data + block.offset, block.size);
+        }
+        else if (ok && block.encoding == GOLB_BLOCK_RLE) ok = rleDecode(data + block.offset, block.size, dst, block.rawSize);
+        else ok = false;
+
+        if (!ok || crc32(dst, block.rawSize) != block.checksum)
+        {
+#pragma omp critical
+            if (badBlock < 0 || b < badBlock) badBlock = b;
+        }
+    }
+    if (badBlock >= 0)
+    {
+        std::cerr << "error reading " << filePath << ": block " << badBlock << " is corrupt" << std::endl;
+        delete[] bits;
+        return false;
+    }
+
+    board = emptyBoard(width, height, header.generation);
+    if (layout == LAYOUT_BITS)
+    {
+        board.bitCells = bits;
+        return true;
+    }
+
+    // unpack into bytes, for seq add the neighbour counts afterwards
+    size_t count = (size_t)width * height;
+    unsigned char* bytes = new unsigned char[count];
+    int y;
+#pragma omp parallel for schedule(static)
+    for (y = 0; y < (int)height; y++)
+    {
+        const uint64_t* row = bits + (size_t)y * words;
+        for (unsigned int x = 0; x < width; x++) bytes[(size_t)y * width + x] = (row[x / 64] >> (x % 64)) & 1;
+    }
+    delete[] bits;
+
+    if (layout == LAYOUT_SEQ)
+    {
+        unsigned char* encoded = new unsigned char[count];
+        encodeNeighbours(bytes, encoded, width, height);
+        delete[] bytes;
+        bytes = encoded;
+    }
+    board.cells = bytes;
+
+    return true;
+}
+
+// writes board as .golb snapshot
+bool writeGolb(const char* filePath, GolLayout layout, const BoardView& board)
+{
+    if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
+    GolbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GOLB_MAGIC, 4);
+    header.version = GOLB_VERSION;
+    header.width = board.w;
+    header.height = board.h;
+    header.generation = board.generation;
+    header.birth = rule.birth;
+    header.survive = rule.survive;
+    header.layout = GOLB_LAYOUT_BITS;
+    header.rowsPerBlock = GOLB_ROWS_PER_BLOCK;
+    header.blockCount = (board.h + GOLB_ROWS_PER_BLOCK - 1) / GOLB_ROWS_PER_BLOCK;
+
+    size_t rowBytes = (size_t)board.words_per_row * 8;
+    std::vector<GolbBlock> blocks(header.blockCount);
+    std::vector<std::vector<unsigned char> > payload(header.blockCount);
+
+    int b;
+#pragma omp parallel for schedule(dynamic)
+    for (b = 0; b < (int)header.blockCount; b++)
+    {
+        unsigned int y0 = b * GOLB_ROWS_PER_BLOCK;
+        unsigned int rows = std::min((unsigned int)GOLB_ROWS_PER_BLOCK, board.h - y0);
+        std::vector<uint64_t> raw((size_t)rows * board.words_per_row);
+        if (layout == LAYOUT_BITS) memcpy(raw.data(), board.bitCells + (size_t)y0 * board.words_per_row, raw.size() * 8);
+        else
+        {
+            for (unsigned int y = 0; y < rows; y++)
+            {
+                const unsigned char* row = board.cells + (size_t)(y0 + y) * board.w;
+                for (unsigned int x = 0; x < board.w; x++) raw[(size_t)y * board.words_per_row + x / 64] |= (uint64_t)(row[x] & STATE_ALIVE) << (x % 64);
+            }
+        }
+
+        const unsigned char* bytes = (const unsigned char*)raw.data();
+        GolbBlock& block = blocks[b];
+        block.rawSize = (uint32_t)(rows * rowBytes);
+        block.checksum = crc32(bytes, block.rawSize);
+        block.encoding = GOLB_BLOCK_RAW;
+        if (compressSnapshots) rleEncode(bytes, block.rawSize, payload[b]);
+        if (compressSnapshots && payload[b].size() < block.rawSize) block.encoding = GOLB_BLOCK_RLE;
+        else payload[b].assign(bytes, bytes + block.rawSize);
+        block.size = (uint32_t)payload[b].size();
+    }
+
+    uint64_t offset = sizeof(header) + blocks.size() * sizeof(GolbBlock);
+    for (GolbBlock& block : blocks)
+    {
+        block.offset = offset;
+        offset += block.size;
+    }
+
+    FILE* out = fopen(filePath, "wb");
+    if (out == 0)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(blocks.data(), sizeof(GolbBlock), blocks.size(), out) == blocks.size();
+    for (size_t i = 0; ok && i < payload.size(); i++) ok = fwrite(payload[i].data(), 1, payload[i].size(), out) == payload[i].size();
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok) std::cerr << "error writing " << filePath << std::endl;
+    return ok;
+}
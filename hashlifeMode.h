@@ -0,0 +1,490 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+hashlife mode:
+the board is stored as a quadtree of canonical (hash consed) nodes, equal
+sub squares anywhere on the board and in any generation share one node. each
+node of level k (2^k x 2^k cells) memoises its RESULT: the centre square of
+level k - 1 after 2^step generations, so repetitive or empty regions are only
+calculated once and a single call jumps many generations at once.
+
+the requested number of generations is split in powers of two (largest
+first), one jump per set bit. memoised results are only valid for one step
+size and are dropped whenever it changes.
+
+IMPORTANT - plane semantics: other than the other modes this one does NOT
+wrap around at the borders. the board is placed on an infinite, initially
+dead plane and the written output is the w x h window the board was loaded
+into; anything that leaves the window still exists, but is not written. for
+boards with live cells at the borders the results differ from seq / omp.
+
+memory: nodes come from a pool, --hashlife-mem <MB> limits its size. when a
+new node would exceed the limit, all nodes not reachable from the current
+board or from the squares a running jump still works on are collected, even
+in the middle of a jump, and results pointing to them are dropped. only if
+the reachable nodes themselves fill most of the pool it grows beyond the
+limit, and the following jumps are made smaller.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+#include "rule.h"
+
+struct HashNode
+{
+    HashNode* nw;
+    HashNode* ne;
+    HashNode* sw;
+    HashNode* se;
+    HashNode* result;       // centre after 2^step gens, 0 if not yet calculated
+    HashNode* next;         // chain in hash table or free list
+    uint64_t population;    // for leaves: 0 dead, 1 alive
+    uint32_t level;
+    uint32_t mark;          // set during garbage collection
+};
+
+class HashLife
+{
+public:
+    HashLife(size_t maxMemoryMB)
+    {
+        maxNodes = (maxMemoryMB << 20) / sizeof(HashNode);
+        gcLimit = maxNodes;
+        buckets.assign(1 << 16, (HashNode*)0);
+        dead = allocNode();
+        alive = allocNode();
+        *dead = HashNode();
+        *alive = HashNode();
+        alive->population = 1;
+        emptyNodes.push_back(dead);
+    }
+
+    ~HashLife()
+    {
+        for (HashNode* block : blocks) delete[] block;
+    }
+
+    // builds the tree from a byte per cell board, cell (0, 0) is at the origin
+    void load(const unsigned char* board, unsigned int width, unsigned int height)
+    {
+        unsigned int level = 3;
+        while ((1u << level) < width || (1u << level) < height) level++;
+
+        // all 65536 possible 4x4 squares are cached while building, most lookups end here
+        std::vector<HashNode*> level2(1 << 16, (HashNode*)0);
+        root = build(board, width, height, 0, 0, level, level2);
+        originX = 0;
+        originY = 0;
+    }
+
+    // writes the window [0, width) x [0, height) back to a byte per cell board
+    void store(unsigned char* board, unsigned int width, unsigned int height) const
+    {
+        memset(board, 0, (size_t)width * height);
+        extract(root, originX, originY, board, width, height);
+    }
+
+    void run(uint64_t generations)
+    {
+        unsigned int maxStep = 63;
+        collectInStep = true;
+        while (generations > 0)
+        {
+            unsigned int step = 0;
+            while (step < maxStep && (generations >> (step + 1)) != 0) step++;
+
+            advance(step);
+            generations -= 1ULL << step;
+
+            Timing::getInstance()->addValue("hashlife nodes", (double)nodeCount);
+            if (nodeCount > maxNodes / 2)
+            {
+                collect();
+                if (nodeCount > maxNodes / 2 && maxStep > 0) maxStep = step - (step > 0);
+            }
+        }
+        collectInStep = false;
+    }
+
+    uint64_t population() const { return root->population; }
+
+private:
+    std::vector<HashNode*> blocks;
+    std::vector<HashNode*> buckets;
+    std::vector<HashNode*> emptyNodes;  // canonical dead square per level
+    std::vector<HashNode*> pins;        // squares of running steps, kept by collect
+    HashNode* freeList = 0;
+    HashNode* dead;
+    HashNode* alive;
+    HashNode* root = 0;
+    int64_t originX = 0;                // board coordinates of the root's top left cell
+    int64_t originY = 0;
+    size_t nodeCount = 0;
+    size_t maxNodes;
+    size_t gcLimit;                     // node count that triggers a collection inside a jump
+    bool collectInStep = false;         // only while running, building the board pins nothing
+    int stepLog = -1;                   // step size (2^stepLog gens) of all memoised results
+
+    static const size_t BLOCK_SIZE = 1 << 16;
+
+    HashNode* allocNode()
+    {
+        if (freeList == 0)
+        {
+            HashNode* block = new HashNode[BLOCK_SIZE];
+            blocks.push_back(block);
+            for (size_t i = 0; i < BLOCK_SIZE; i++)
+            {
+                block[i].next = freeList;
+                freeList = block + i;
+            }
+        }
+
+        HashNode* node = freeList;
+        freeList = node->next;
+        nodeCount++;
+        return node;
+    }
+
+    static size_t hash(const HashNode* nw, const HashNode* ne, const HashNode* sw, const HashNode* se)
+    {
+        uint64_t h = (uint64_t)(uintptr_t)nw * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (uint64_t)(uintptr_t)ne) * 0xC2B2AE3D27D4EB4FULL;
+        h = (h ^ (uint64_t)(uintptr_t)sw) * 0x165667B19E3779F9ULL;
+        h = (h ^ (uint64_t)(uintptr_t)se) * 0x9E3779B97F4A7C15ULL;
+        return (size_t)(h ^ (h >> 29));
+    }
+
+    void rehash(size_t size)
+    {
+        std::vector<HashNode*> table(size, (HashNode*)0);
+        for (HashNode* chain : buckets)
+        {
+            while (chain != 0)
+            {
+                HashNode* node = chain;
+                chain = chain->next;
+                size_t slot = hash(node->nw, node->ne, node->sw, node->se) & (size - 1);
+                node->next = table[slot];
+                table[slot] = node;
+            }
+        }
+        buckets.swap(table);
+    }
+
+    // canonical node for the four quadrants, created if not yet known
+    HashNode* join(HashNode* nw, HashNode* ne, HashNode* sw, HashNode* se)
+    {
+        size_t slot = hash(nw, ne, sw, se) & (buckets.size() - 1);
+        for (HashNode* node = buckets[slot]; node != 0; node = node->next)
+        {
+            if (node->nw == nw && node->ne == ne && node->sw == sw && node->se == se) return node;
+        }
+
+        if (collectInStep && nodeCount >= gcLimit)
+        {
+            size_t pinned = pins.size();
+            pins.insert(pins.end(), { nw, ne, sw, se });
+            collect();
+            pins.resize(pinned);
+            slot = hash(nw, ne, sw, se) & (buckets.size() - 1);
+        }
+
+        HashNode* node = allocNode();
+        node->nw = nw;
+        node->ne = ne;
+        node->sw = sw;
+        node->se = se;
+        node->result = 0;
+        node->population = nw->population + ne->population + sw->population + se->population;
+        node->level = nw->level + 1;
+        node->mark = 0;
+        node->next = buckets[slot];
+        buckets[slot] = node;
+
+        if (nodeCount > buckets.size()) rehash(buckets.size() * 2);
+        return node;
+    }
+
+    HashNode* empty(unsigned int level)
+    {
+        while (emptyNodes.size() <= level)
+        {
+            HashNode* e = emptyNodes.back();
+            emptyNodes.push_back(join(e, e, e, e));
+        }
+        return emptyNodes[level];
+    }
+
+    HashNode* build(const unsigned char* board, unsigned int width, unsigned int height,
+        unsigned int x, unsigned int y, unsigned int level, std::vector<HashNode*>& level2)
+    {
+        if (x >= width || y >= height) return empty(level);
+
+        if (level == 2)
+        {
+            unsigned int bits = 0;
+            for (unsigned int dy = 0; dy < 4; dy++)
+            {
+                for (unsigned int dx = 0; dx < 4; dx++)
+                {
+                    if (x + dx < width && y + dy < height && (board[(size_t)(y + dy) * width + x + dx] & STATE_ALIVE))
+                        bits |= 1u << (dy * 4 + dx);
+                }
+            }
+
+            HashNode*& node = level2[bits];
+            if (node == 0)
+            {
+                HashNode* c[16];
+                for (int i = 0; i < 16; i++) c[i] = (bits >> i) & 1 ? alive : dead;
+                node = join(join(c[0], c[1], c[4], c[5]), join(c[2], c[3], c[6], c[7]),
+                    join(c[8], c[9], c[12], c[13]), join(c[10], c[11], c[14], c[15]));
+            }
+            return node;
+        }
+
+        unsigned int half = 1u << (level - 1);
+        return join(build(board, width, height, x, y, level - 1, level2),
+            build(board, width, height, x + half, y, level - 1, level2),
+            build(board, width, height, x, y + half, level - 1, level2),
+            build(board, width, height, x + half, y + half, level - 1, level2));
+    }
+
+    void extract(const HashNode* node, int64_t x, int64_t y, unsigned char* board, unsigned int width, unsigned int height) const
+    {
+        int64_t size = (int64_t)1 << node->level;
+        if (node->population == 0 || x >= (int64_t)width || y >= (int64_t)height || x + size <= 0 || y + size <= 0) return;
+
+        if (node->level == 0)
+        {
+            board[(size_t)y * width + (size_t)x] = STATE_ALIVE;
+            return;
+        }
+
+        int64_t half = size / 2;
+        extract(node->nw, x, y, board, width, height);
+        extract(node->ne, x + half, y, board, width, height);
+        extract(node->sw, x, y + half, board, width, height);
+        extract(node->se, x + half, y + half, board, width, height);
+    }
+
+    HashNode* pin(HashNode* node)
+    {
+        pins.push_back(node);
+        return node;
+    }
+
+    HashNode* centre(HashNode* node)
+    {
+        return join(node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+    }
+
+    // one generation for the centre 2x2 of a 4x4 square
+    HashNode* stepLevel2(HashNode* node)
+    {
+        unsigned int bits = 0;
+        HashNode* quads[4] = { node->nw, node->ne, node->sw, node->se };
+        for (int q = 0; q < 4; q++)
+        {
+            unsigned int shift = (q & 1) * 2 + (q >> 1) * 8;
+            bits |= (unsigned int)quads[q]->nw->population << shift;
+            bits |= (unsigned int)quads[q]->ne->population << (shift + 1);
+            bits |= (unsigned int)quads[q]->sw->population << (shift + 4);
+            bits |= (unsigned int)quads[q]->se->population << (shift + 5);
+        }
+
+        HashNode* c[4];
+        int i = 0;
+        for (int y = 1; y <= 2; y++)
+        {
+            for (int x = 1; x <= 2; x++)
+            {
+                int countNeighbours = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        if (dx != 0 || dy != 0) countNeighbours += (bits >> ((y + dy) * 4 + x + dx)) & 1;
+                    }
+                }
+                int value = (bits >> (y * 4 + x)) & 1;
+                c[i++] = (((value ? rule.survive : rule.birth) >> countNeighbours) & 1) ? alive : dead;
+            }
+        }
+        return join(c[0], c[1], c[2], c[3]);
+    }
+
+    // centre of the node after 2^stepLog generations (stepLog <= level - 2)
+    HashNode* step(HashNode* node)
+    {
+        if (node->population == 0) return empty(node->level - 1);
+        if (node->result != 0) return node->result;
+        if (node->level == 2) return node->result = stepLevel2(node);
+
+        // every square created below is pinned until the result is stored,
+        // a collection in between would free it otherwise
+        size_t pinned = pins.size();
+        pin(node);
+
+        // the nine overlapping sub squares of level k - 1
+        HashNode* n00 = node->nw;
+        HashNode* n01 = pin(join(node->nw->ne, node->ne->nw, node->nw->se, node->ne->sw));
+        HashNode* n02 = node->ne;
+        HashNode* n10 = pin(join(node->nw->sw, node->nw->se, node->sw->nw, node->sw->ne));
+        HashNode* n11 = pin(centre(node));
+        HashNode* n12 = pin(join(node->ne->sw, node->ne->se, node->se->nw, node->se->ne));
+        HashNode* n20 = node->sw;
+        HashNode* n21 = pin(join(node->sw->ne, node->se->nw, node->sw->se, node->se->sw));
+        HashNode* n22 = node->se;
+
+        HashNode* r00, * r01, * r02, * r10, * r11, * r12, * r20, * r21, * r22;
+        if (stepLog >= (int)node->level - 2)
+        {
+            // full speed: two half steps of 2^(k - 3) gens each
+            r00 = pin(step(n00)); r01 = pin(step(n01)); r02 = pin(step(n02));
+            r10 = pin(step(n10)); r11 = pin(step(n11)); r12 = pin(step(n12));
+            r20 = pin(step(n20)); r21 = pin(step(n21)); r22 = pin(step(n22));
+        }
+        else
+        {
+            // smaller step: no time passes here, only in the second half
+            r00 = pin(centre(n00)); r01 = pin(centre(n01)); r02 = pin(centre(n02));
+            r10 = pin(centre(n10)); r11 = pin(centre(n11)); r12 = pin(centre(n12));
+            r20 = pin(centre(n20)); r21 = pin(centre(n21)); r22 = pin(centre(n22));
+        }
+
+        HashNode* s0 = pin(step(pin(join(r00, r01, r10, r11))));
+        HashNode* s1 = pin(step(pin(join(r01, r02, r11, r12))));
+        HashNode* s2 = pin(step(pin(join(r10, r11, r20, r21))));
+        HashNode* s3 = pin(step(pin(join(r11, r12, r21, r22))));
+        HashNode* result = join(s0, s1, s2, s3);
+        node->result = result;
+        pins.resize(pinned);
+        return result;
+    }
+
+    // grows the root by one level, keeping the board in the centre
+    void expand()
+    {
+        HashNode* e = empty(root->level - 1);
+        int64_t quarter = (int64_t)1 << (root->level - 1);
+        size_t pinned = pins.size();
+        HashNode* nw = pin(join(e, e, e, root->nw));
+        HashNode* ne = pin(join(e, e, root->ne, e));
+        HashNode* sw = pin(join(e, root->sw, e, e));
+        HashNode* se = pin(join(root->se, e, e, e));
+        root = join(nw, ne, sw, se);
+        pins.resize(pinned);
+        originX -= quarter;
+        originY -= quarter;
+    }
+
+    // advances the whole board by 2^log gens
+    void advance(unsigned int log)
+    {
+        // the pattern must be within the inner quarter and the step small enough,
+        // then it can not grow out of the result square
+        while (root->level < log + 3 || centre(centre(root))->population != root->population) expand();
+
+        if (stepLog != (int)log)
+        {
+            for (HashNode* chain : buckets)
+            {
+                for (HashNode* node = chain; node != 0; node = node->next) node->result = 0;
+            }
+            stepLog = (int)log;
+        }
+
+        int64_t quarter = (int64_t)1 << (root->level - 2);
+        root = step(root);
+        originX += quarter;
+        originY += quarter;
+    }
+
+    void markNode(HashNode* node)
+    {
+        if (node->mark) return;
+        node->mark = 1;
+        if (node->level == 0) return;
+        markNode(node->nw);
+        markNode(node->ne);
+        markNode(node->sw);
+        markNode(node->se);
+    }
+
+    // frees all nodes not reachable from the root, the empty squares or the pinned squares
+    void collect()
+    {
+        markNode(root);
+        for (HashNode* e : emptyNodes) markNode(e);
+        for (HashNode* p : pins) markNode(p);
+
+        for (HashNode*& chain : buckets)
+        {
+            HashNode** link = &chain;
+            while (*link != 0)
+            {
+                HashNode* node = *link;
+                if (node->mark)
+                {
+                    if (node->result != 0 && !node->result->mark) node->result = 0;
+                    link = &node->next;
+                }
+                else
+                {
+                    *link = node->next;
+                    node->next = freeList;
+                    freeList = node;
+                    nodeCount--;
+                }
+            }
+        }
+
+        for (HashNode* chain : buckets)
+        {
+            for (HashNode* node = chain; node != 0; node = node->next) node->mark = 0;
+        }
+        dead->mark = 0;
+        alive->mark = 0;
+
+        // if the reachable nodes fill most of the pool, collecting again soon frees nothing
+        gcLimit = (nodeCount > maxNodes / 4 * 3) ? nodeCount + maxNodes / 4 : maxNodes;
+        Timing::getInstance()->addValue("hashlife gc", (double)nodeCount);
+    }
+};
+
+void runHashLife(const char* fileI, const char* fileO, unsigned int generations, size_t maxMemoryMB)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: hashlife" << std::endl;
+
+    // init grid from file
+    Timing::getInstance()->startSetup();
+    if (rule.birth & 1)
+    {
+        // the infinite plane around the board would come alive
+        std::cerr << "hashlife mode can not run rule " << ruleString(rule) << " (B0)" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!loadBoard(fileI, LAYOUT_BYTES)) exit(EXIT_FAILURE);
+
+    HashLife life(maxMemoryMB);
+    life.load(cells, w, h);
+    if (debugOutput) std::cout << "population: " << life.population() << std::endl;
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    life.run(generations);
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+
+    // write out result
+    Timing::getInstance()->startFinalization();
+    life.store(cells, w, h);
+    saveBoard(fileO, LAYOUT_BYTES);
+    Timing::getInstance()->stopFinalization();
+}
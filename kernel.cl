@@ -1,3 +1,21 @@
+/*
+* rule masks (bit n: born / survives with n neighbours), set by oclMode with
+* -D RULE_BIRTH=.. -D RULE_SURVIVE=.. (--rule), conway if not given
+*/
+#ifndef RULE_BIRTH
+#define RULE_BIRTH 8
+#endif
+#ifndef RULE_SURVIVE
+#define RULE_SURVIVE 12
+#endif
+
+// next state of a cell, living counts the cell itself and its neighbours
+#if RULE_BIRTH == 8 && RULE_SURVIVE == 12
+#define GOL_NEXT(self, living) ((living == 3) + (self) * (living == 4))
+#else
+#define GOL_NEXT(self, living) ((((self) ? RULE_SURVIVE : RULE_BIRTH) >> ((living) - (self))) & 1)
+#endif
+
 /*
 * a kernel for game of life generation
 */
@@ -27,6 +45,74 @@ void kernel gol_generation(global unsigned char* board, global unsigned char* ca
         board[x + width * y1] +
         board[x1 + width * y1];
 
-    cache[id] = (livingNeighbors == 3) + board[id] * (livingNeighbors == 4); // v1 -> ok 87 - 99
+    cache[id] = GOL_NEXT(board[id], livingNeighbors); // v1 -> ok 87 - 99
     //cache[id] = (livingNeighbors == 3) + board[id] * (livingNeighbors == 2); // v2 -> dont add curVal: 97 - 103
-}
\ No newline at end of file
+}
+
+/*
+* tiled kernel (--ocl-kernel tiled), 2D NDRange rounded up to whole work-groups:
+* every work-group loads its tile plus a halo of gens cells into local memory
+* once, advances it gens generations there and writes back the inner tile.
+* the valid region shrinks by one cell per generation, so after gens
+* generations exactly the inner tile is correct.
+* tile holds two buffers of (local size + 2 * gens) cells in each dimension.
+*/
+void kernel gol_tiled(global const unsigned char* board, global unsigned char* cache, unsigned int width, unsigned int height, unsigned int gens, local unsigned char* tile)
+{
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int lw = get_local_size(0);
+    int lh = get_local_size(1);
+    int halo = gens;
+    int tw = lw + 2 * halo;
+    int th = lh + 2 * halo;
+    int tileSize = tw * th;
+    int first = lx + lw * ly; // work-items share the loops over the tile
+    int stride = lw * lh;
+    int originX = get_group_id(0) * lw - halo;
+    int originY = get_group_id(1) * lh - halo;
+
+    local unsigned char* src = tile;
+    local unsigned char* dst = tile + tileSize;
+
+    // load tile and halo, wrapping around the board borders
+    for (int i = first; i < tileSize; i += stride)
+    {
+        int x = (originX + i % tw) % (int)width;
+        int y = (originY + i / tw) % (int)height;
+        x += (x < 0) * (int)width;
+        y += (y < 0) * (int)height;
+        src[i] = board[x + width * y];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int g = 1; g <= halo; g++)
+    {
+        int iw = tw - 2 * g; // region still valid after this generation
+        int count = iw * (th - 2 * g);
+        for (int i = first; i < count; i += stride)
+        {
+            int id = (g + i / iw) * tw + g + i % iw;
+            int livingNeighbors =
+                src[id] +
+                src[id - tw - 1] +
+                src[id - tw] +
+                src[id - tw + 1] +
+                src[id - 1] +
+                src[id + 1] +
+                src[id + tw - 1] +
+                src[id + tw] +
+                src[id + tw + 1];
+            dst[id] = GOL_NEXT(src[id], livingNeighbors);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        local unsigned char* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    unsigned int x = get_global_id(0);
+    unsigned int y = get_global_id(1);
+    if (x < width && y < height) cache[x + width * y] = src[(ly + halo) * tw + lx + halo];
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+lut mode:
+the next states of two neighbouring cells only depend on the 3x4 cells
+around them, which fit into 12 bits. a table of all 4096 neighbourhoods
+gives both next states (2 bits) with one lookup, so no neighbours are
+counted while stepping. the table (4 KB, stays in L1 next to the rows) is
+built at startup for the --rule, any rule runs at the same speed.
+
+the board is kept bit packed like in bits mode (see common.h), a pair of
+rows is processed 64 cells (32 blocks of 2x2) at a time: each of the four
+rows around the pair becomes a window of the cells x - 1 .. x + 64, block j
+reads 4 cells of each window from bit 2 j on, together they form a 16 bit
+index:
+
+    index bits 0 - 3    row above the pair, cells x - 1 .. x + 2
+    index bits 4 - 7    upper row of the pair
+    index bits 8 - 11   lower row of the pair
+    index bits 12 - 15  row below the pair
+
+bits 0 - 11 look up the upper row (x, x + 1), bits 4 - 15 the lower row.
+the windows are split into the nibbles of the even and the odd blocks and
+lutTranspose moves the nibbles of the four rows side by side, so the indices
+of 32 blocks are built with a few swaps instead of 8 shifts and masks each.
+
+wrap around is the same as in the other modes. with an odd width the cell
+behind the last one of a row is filled with the first one, with an odd
+height the last pair only writes its upper row. pairs of rows are
+calculated in parallel.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "boardIO.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "cycle.h"
+#include "rule.h"
+#include "omp.h"
+
+// next states of the two middle cells of every 3x4 neighbourhood under the rule, rebuilt if it changed
+const unsigned char* lutTable()
+{
+    static Rule built = { 0, 0 };
+    static std::vector<unsigned char> table;
+    if (table.empty() || built != rule)
+    {
+        std::vector<unsigned char> next(1 << 12);
+        for (unsigned int index = 0; index < next.size(); index++)
+        {
+            auto cell = [index](int row, int col) { return (index >> (row * 4 + col)) & 1; };
+            unsigned char result = 0;
+            for (int col = 1; col <= 2; col++)
+            {
+                int countNeighbours = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        if (dy != 0 || dx != 0) countNeighbours += cell(1 + dy, col + dx);
+                    }
+                }
+                result |= (((cell(1, col) ? rule.survive : rule.birth) >> countNeighbours) & 1) << (col - 1);
+            }
+            next[index] = result;
+        }
+        table.swap(next);
+        built = rule;
+    }
+    return table.data();
+}
+
+// word k of a row, with an odd width the first cell of the row follows the last one
+inline uint64_t lutWord(const uint64_t* row, unsigned int k, unsigned int lastWord, unsigned int lastBit)
+{
+    if (k == lastWord && lastBit < 63) return row[k] | ((row[0] & 1) << (lastBit + 1));
+    return row[k];
+}
+
+// transposes the 4 x 16 nibbles of the words: afterwards lane i (16 bits) of word q holds
+// nibble 4 q + i of every word, the one of words[r] in its bits 4 r .. 4 r + 3
+inline void lutTranspose(uint64_t words[4])
+{
+    // 16 bit quarters: word q gets quarter q of every word
+    for (int r = 0; r < 2; r++)
+    {
+        uint64_t t = ((words[r] >> 32) ^ words[r + 2]) & 0x00000000FFFFFFFFULL;
+        words[r] ^= t << 32;
+        words[r + 2] ^= t;
+    }
+    for (int r = 0; r < 4; r += 2)
+    {
+        uint64_t t = ((words[r] >> 16) ^ words[r + 1]) & 0x0000FFFF0000FFFFULL;
+        words[r] ^= t << 16;
+        words[r + 1] ^= t;
+    }
+    // nibbles inside the quarters
+    for (int q = 0; q < 4; q++)
+    {
+        uint64_t x = words[q];
+        uint64_t t = ((x >> 24) ^ x) & 0x00000000FF00FF00ULL;
+        x ^= t ^ (t << 24);
+        t = ((x >> 12) ^ x) & 0x0000F0F00000F0F0ULL;
+        words[q] = x ^ t ^ (t << 12);
+    }
+}
+
+// calculates the rows of a pair, lower is 0 for the last pair of an odd height
+inline void lutStepPair(const unsigned char* table, const uint64_t* rows[4], uint64_t* upper, uint64_t* lower,
+    unsigned int words, unsigned int lastBit, uint64_t lastMask)
+{
+    unsigned int lastWord = words - 1;
+    for (unsigned int k = 0; k < words; k++)
+    {
+        // windows of cells 64 k - 1 ... 64 k + 64: even blocks read nibble m of even[r],
+        // odd blocks nibble m of odd[r]
+        uint64_t even[4];
+        uint64_t odd[4];
+        for (int r = 0; r < 4; r++)
+        {
+            const uint64_t* row = rows[r];
+            uint64_t word = lutWord(row, k, lastWord, lastBit);
+            uint64_t left = (k == 0) ? (row[lastWord] >> lastBit) : (row[k - 1] >> 63);
+            uint64_t right = (k == lastWord) ? row[0] : row[k + 1];
+            even[r] = (word << 1) | (left & 1);
+            odd[r] = (word >> 1) | ((right & 1) << 63);
+        }
+
+        // lane i of even[q] / odd[q] is the 16 bit index of block 8 q + 2 i / 8 q + 2 i + 1
+        lutTranspose(even);
+        lutTranspose(odd);
+
+        uint64_t top = 0;
+        uint64_t bot = 0;
+        for (int q = 0; q < 4; q++)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                unsigned int e = (unsigned int)(even[q] >> (16 * i)) & 0xFFFF;
+                unsigned int o = (unsigned int)(odd[q] >> (16 * i)) & 0xFFFF;
+                int shift = 16 * q + 4 * i;
+                top |= (uint64_t)(table[e & 0xFFF] | (table[o & 0xFFF] << 2)) << shift;
+                bot |= (uint64_t)(table[e >> 4] | (table[o >> 4] << 2)) << shift;
+            }
+        }
+        upper[k] = top;
+        if (lower != 0) lower[k] = bot;
+    }
+    upper[lastWord] &= lastMask;
+    if (lower != 0) lower[lastWord] &= lastMask;
+}
+
+void lutGeneration(const uint64_t* src, uint64_t* dst)
+{
+    const unsigned char* table = lutTable();
+    int pairs = (int)(h + 1) / 2;
+    unsigned int words = words_per_row;
+    unsigned int lastBit = col_right % 64;
+    uint64_t lastMask = (lastBit == 63) ? ~0ULL : ((1ULL << (lastBit + 1)) - 1);
+
+    int pair;
+#pragma omp parallel for schedule(static)
+    for (pair = 0; pair < pairs; pair++)
+    {
+        int y = pair * 2;
+        const uint64_t* rows[4];
+        for (int r = 0; r < 4; r++)
+        {
+            rows[r] = src + (size_t)((y - 1 + r + (int)h) % (int)h) * words;
+        }
+        uint64_t* lower = (y + 1 < (int)h) ? dst + (size_t)(y + 1) * words : 0;
+        lutStepPair(table, rows, dst + (size_t)y * words, lower, words, lastBit, lastMask);
+    }
+}
+
+void runLUT(const char* fileI, const char* fileO, unsigned int generations, int threads)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: lut" << std::endl;
+
+    // init grid from file
+    Timing::getInstance()->startSetup();
+    if (!checkpointer.load(fileI, LAYOUT_BITS, generations)) exit(EXIT_FAILURE);
+    if (!emitter.start(LAYOUT_BITS, bitCells)) exit(EXIT_FAILURE);
+    cycles.start(LAYOUT_BITS, true);
+
+    if (threads != omp_get_num_threads()) omp_set_num_threads(threads);
+    if (debugOutput) std::cout << "number of processors: " << omp_get_num_procs() << ", set number of threads: " << threads << std::endl;
+
+    oldBitCells = new uint64_t[(size_t)words_per_row * h];
+    lutTable();
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    for (unsigned int gen = 0; gen < generations; gen++)
+    {
+        TIMING_SCOPE("generation");
+        lutGeneration(bitCells, oldBitCells);
+        std::swap(bitCells, oldBitCells);
+        checkpointer.after(gen + 1, bitCells);
+        emitter.after(gen + 1, bitCells);
+        gen += cycles.after(gen + 1, bitCells, generations);
+    }
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+
+    // write out result
+    Timing::getInstance()->startFinalization();
+    saveBoard(fileO, LAYOUT_BITS);
+    checkpointer.finish();
+    emitter.finish();
+    Timing::getInstance()->stopFinalization();
+}
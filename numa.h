@@ -0,0 +1,200 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+numa (omp mode):
+the loader touches every page of the board on one thread, so with the default
+first-touch policy the whole board lands on the memory of that thread's node
+and threads of other sockets only access remote memory.
+
+--numa splits the board into one band of rows per thread, band t always
+belongs to omp thread t (also across generations, no schedule decides it).
+each thread copies its band into freshly allocated boards, so its pages are
+allocated on the node the thread runs on. only the plain generation loop
+(no --tiles / --time-block) uses the bands.
+
+--affinity pins the omp threads to cores, so they do not migrate away from
+their pages:
+    compact     fills the cores of one node before the next
+    spread      deals the threads round robin over the nodes
+nodes and cores are read from /sys/devices/system/node (linux only,
+elsewhere pinning is skipped and everything counts as node 0).
+
+with --numa Timing gets per node the computation time of each of its threads
+("numa node <n> ms") and their bandwidth ("numa node <n> GB/s", bytes of the
+band read and written per generation / time), a node with remote pages shows
+up with a lower bandwidth.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "omp.h"
+
+#include <fstream>
+#include <sstream>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+struct NumaTopology
+{
+    std::vector<std::vector<int> > nodes;   // cpus of each node
+    std::vector<int> nodeOf;                // node of each cpu
+};
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+std::vector<int> numaCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::istringstream stream(text);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        size_t dash = range.find('-');
+        try
+        {
+            int first = std::stoi(range.substr(0, dash));
+            int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        }
+        catch (const std::exception&)
+        {
+            // empty node or unexpected format
+        }
+    }
+    return cpus;
+}
+
+NumaTopology numaTopology()
+{
+    NumaTopology topology;
+#ifdef __linux__
+    for (int node = 0; ; node++)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) break;
+        std::string line;
+        std::getline(file, line);
+        topology.nodes.push_back(numaCpuList(line));
+    }
+#endif
+    if (topology.nodes.empty())
+    {
+        topology.nodes.resize(1);
+        for (int cpu = 0; cpu < omp_get_num_procs(); cpu++) topology.nodes[0].push_back(cpu);
+    }
+
+    for (size_t node = 0; node < topology.nodes.size(); node++)
+    {
+        for (int cpu : topology.nodes[node])
+        {
+            if (cpu >= (int)topology.nodeOf.size()) topology.nodeOf.resize(cpu + 1, 0);
+            topology.nodeOf[cpu] = (int)node;
+        }
+    }
+    return topology;
+}
+
+// order in which threads are pinned to cpus for --affinity compact / spread
+std::vector<int> numaCpuOrder(const NumaTopology& topology, const std::string& affinity)
+{
+    std::vector<int> order;
+    if (affinity == "compact")
+    {
+        for (const std::vector<int>& cpus : topology.nodes) order.insert(order.end(), cpus.begin(), cpus.end());
+    }
+    else if (affinity == "spread")
+    {
+        for (size_t i = 0; ; i++)
+        {
+            size_t added = 0;
+            for (const std::vector<int>& cpus : topology.nodes)
+            {
+                if (i >= cpus.size()) continue;
+                order.push_back(cpus[i]);
+                added++;
+            }
+            if (added == 0) break;
+        }
+    }
+    return order;
+}
+
+// node the calling thread runs on
+int numaCurrentNode(const NumaTopology& topology)
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < (int)topology.nodeOf.size()) return topology.nodeOf[cpu];
+#endif
+    return 0;
+}
+
+// pins every thread of the following omp parallel regions to a cpu, returns false if not supported
+bool numaPinThreads(const NumaTopology& topology, const std::string& affinity)
+{
+    std::vector<int> order = numaCpuOrder(topology, affinity);
+    if (order.empty())
+    {
+        std::cerr << "unknown --affinity " << affinity << ", possible values are compact and spread" << std::endl;
+        return false;
+    }
+#ifdef __linux__
+    bool pinned = true;
+#pragma omp parallel reduction(&& : pinned)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(order[omp_get_thread_num() % order.size()], &set);
+        pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+    if (!pinned) std::cerr << "pinning threads for --affinity " << affinity << " failed" << std::endl;
+    return pinned;
+#else
+    std::cerr << "--affinity is only supported on linux" << std::endl;
+    return false;
+#endif
+}
+
+// rows [from, to) of the band of thread t out of count threads
+inline void numaBand(int t, int count, int& from, int& to)
+{
+    from = (int)((int64_t)h * t / count);
+    to = (int)((int64_t)h * (t + 1) / count);
+}
+
+// copies board into a new board whose bands are first touched by their threads,
+// returns the node each thread ran on
+unsigned char* numaPlace(const unsigned char* board, const NumaTopology& topology, std::vector<int>& threadNodes)
+{
+    unsigned char* placed = new unsigned char[total_elem_count];
+#pragma omp parallel
+    {
+        int t = omp_get_thread_num();
+        int count = omp_get_num_threads();
+#pragma omp single
+        threadNodes.assign(count, 0);
+
+        int from, to;
+        numaBand(t, count, from, to);
+        memcpy(placed + (size_t)from * w, board + (size_t)from * w, (size_t)(to - from) * w);
+        threadNodes[t] = numaCurrentNode(topology);
+    }
+    return placed;
+}
+
+// per node: computation time and bandwidth of each of its threads
+void numaReport(const std::vector<int>& threadNodes, const std::vector<double>& threadMs, unsigned int generations)
+{
+    for (size_t t = 0; t < threadNodes.size(); t++)
+    {
+        int from, to;
+        numaBand((int)t, (int)threadNodes.size(), from, to);
+        // the band and its two neighbour rows are read, the band is written
+        double bytes = (double)generations * ((to - from + 2) + (to - from)) * w;
+        std::string node = "numa node " + std::to_string(threadNodes[t]);
+        Timing::getInstance()->addValue(node + " ms", threadMs[t]);
+        Timing::getInstance()->addValue(node + " GB/s", threadMs[t] > 0 ? bytes / threadMs[t] / 1e6 : 0);
+        if (debugOutput) std::cout << "thread " << t << " (node " << threadNodes[t] << ", rows " << from << " - " << to << "): "
+            << threadMs[t] << " ms, " << (threadMs[t] > 0 ? bytes / threadMs[t] / 1e6 : 0) << " GB/s" << std::endl;
+    }
+}
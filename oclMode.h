@@ -1,223 +1,322 @@
 #pragma once
 
 #include "common.h"
+#include "boardIO.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "rule.h"
 
-#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
-#define CL_TARGET_OPENCL_VERSION 220
-#define __CL_ENABLE_EXCEPTIONS // to use cl::Error
 // adapted from opencltest
 // requirements: 
 // - runs only for x86 builds
 // - CUDA Toolkit 9.0 (sets the environment variable CUDA_PATH)
 // - cl.hpp, the C++ bindings for OpenCL v 1.2
-#include <CL/cl.hpp>
+#include "oclProgram.h" // CL/cl.hpp, oclBuild
 //#include <CL/cl.h>
 
 const std::string KERNEL_FILE = "kernel.cl";
 
+// work-group size of the tiled kernel, halved while the device does not allow it
+#define OCL_TILE_W 16
+#define OCL_TILE_H 16
+
 cl::Buffer boardBuffer;
 cl::Buffer cacheBuffer;
-cl::Kernel kernel;
+cl::Kernel kernels[2];      // gol_generation, [0] reads boardBuffer and writes cacheBuffer, [1] the other way round
+cl::Kernel tiledKernels[2]; // gol_tiled, same buffers as kernels
 cl::CommandQueue queue;
+cl::Context context;
+cl::Device device;
+bool oclReady = false; // context, program, kernel and queue are built once per process (--batch runs several boards)
+
+std::string oclCacheDir = "oclcache"; // --ocl-cache, empty disables, see oclProgram.h
+bool oclKeepResult = false; // also copy the result into cells, for callers reading the board afterwards (bench)
 
-void oclReadFromFile(const char* filePath)
+void initOCL(unsigned int platformId, unsigned int deviceId)
 {
-	if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
-	std::ifstream in(filePath);
-	if (in.is_open())
-	{
-		std::string line;
-		std::getline(in, line); // get first line for explizit w / h
+	std::vector<cl::Device> devices;
 
-		// TODO: better split
-		size_t pos = line.find(',');
-		if (pos != std::string::npos)
-		{
-			w = std::stoi(line.substr(0, pos));
-			h = std::stoi(line.substr(pos + 1));
-		}
-		else // use default values
+	try
+	{
+		if (!oclReady)
 		{
-			w = 1000;
-			h = 10000;
-		}
-
-		total_elem_count = w * h;
-		col_right = w - 1;
-		col_bot = total_elem_count - w;
-		row_bot = h - 1;
-		if (debugOutput) std::cout << "total: " << total_elem_count << ", w: " << w << ", h: " << h << std::endl;
-		if (debugOutput) std::cout << "col_right: " << col_right << ", col_bot: " << col_bot << ", row_bot: " << row_bot << std::endl;
+			// get available platforms ( NVIDIA, Intel, AMD,...)
+			std::vector<cl::Platform> platforms;
+			cl::Platform::get(&platforms);
+			if (platforms.size() == 0 || platforms.size() < platformId) throw "specified OpenCL platform not available!";
 
-		cells = new unsigned char[total_elem_count];
-		memset(cells, 0, total_elem_count);
-
-		unsigned int idx = 0;
-		char c;
-		for (unsigned int y = 0; y < h; y++)
-		{
-			getline(in, line);
-			for (unsigned int x = 0; x < w; x++)
+#ifdef _DEBUG
+			// test output to gather information about installed hardware:
+			// SyntaX-Desktop:
+			//	platform: NVIDIA CUDA
+			//		device: GeForce GTX 1080
+			//	platform: Intel(R) OpenCL HD Graphics
+			//		device : Intel(R) HD Graphics 530
+			for (auto& platform : platforms)
 			{
-				c = line[x];
-				//std::cout << "read c: " << c << " for index: " << idx << std::endl;
-				if (c == 'x')  // only need to set alive cells, otherwise stay 0
+				std::cout << "platform: " << platform.getInfo<CL_PLATFORM_NAME>() << "\n";
+				//cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(platform)(), 0 };
+				//cl::Context context(CL_DEVICE_TYPE_ALL, properties);
+				//devices = context.getInfo<CL_CONTEXT_DEVICES>();
+				platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+				for (auto& device : devices)
 				{
-					*(cells + idx) = STATE_ALIVE;
+					std::cout << "device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
 				}
+			}
+#endif
 
-				if (++idx >= total_elem_count) break;
+			// create a context and get available devices
+			cl::Platform platform = platforms[platformId];
+			if (debugOutput) std::cout << "using platform: " << platform.getInfo<CL_PLATFORM_NAME>() << "\n";
+
+			platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
+			if (devices.size() == 0 || devices.size() < deviceId) throw "specified OpenCL device not available!";
+
+			device = devices[deviceId];
+			if (debugOutput) std::cout << "using device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+
+			context = cl::Context({ device });
+		 	cl::Program::Sources sources;
+
+			// load and build the kernel
+			std::ifstream sourceFile(KERNEL_FILE);
+			if (!sourceFile) std::cerr << "kernel source file " << KERNEL_FILE << " not found!" << std::endl;
+
+			std::string sourceCode(
+				std::istreambuf_iterator<char>(sourceFile),
+				(std::istreambuf_iterator<char>()));
+			// the rule is compiled into the kernel, binaries of other rules get another cache key
+			Timing::getInstance()->startRecord("ocl build");
+			bool hit = false;
+			cl::Program program = oclBuild(context, platform, device, sourceCode, oclOptions(rule), oclCacheDir, hit);
+			Timing::getInstance()->stopRecord("ocl build");
+			Timing::getInstance()->addValue("ocl cache hit", hit ? 1 : 0);
+			if (debugOutput) std::cout << "kernel cache " << (hit ? "hit" : "miss") << "\n";
+
+			for (int i = 0; i < 2; i++)
+			{
+				kernels[i] = cl::Kernel(program, "gol_generation");
+				tiledKernels[i] = cl::Kernel(program, "gol_tiled");
 			}
+
+			queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+			oclReady = true;
 		}
-	}
-	else std::cout << "error opening " << filePath << std::endl;
 
-	if (!in.eof() && in.fail())
-		std::cout << "error reading " << filePath << std::endl;
+		// init buffer for this board, host allocated so the read back is a map without copy on cpu devices
+		boardBuffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(unsigned char) * total_elem_count);
+		cacheBuffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(unsigned char) * total_elem_count);
+		queue.enqueueWriteBuffer(boardBuffer, CL_TRUE, 0, sizeof(unsigned char) * total_elem_count, cells);
 
-	in.close();
+		// arguments which stay the same for the whole run, the buffers alternate between the kernels of a pair
+		for (int i = 0; i < 2; i++)
+		{
+			const cl::Buffer& src = (i == 0) ? boardBuffer : cacheBuffer;
+			const cl::Buffer& dst = (i == 0) ? cacheBuffer : boardBuffer;
+			kernels[i].setArg(0, src);
+			kernels[i].setArg(1, dst);
+			kernels[i].setArg(2, w);
+			kernels[i].setArg(3, h);
+			tiledKernels[i].setArg(0, src);
+			tiledKernels[i].setArg(1, dst);
+			tiledKernels[i].setArg(2, w);
+			tiledKernels[i].setArg(3, h);
+		}
+	}
+	catch (cl::Error err)
+	{
+		std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+	}
 }
 
-void oclWriteToFile(const char* filePath, bool drawNeighbours = false)
+// kernel launches whose profiling info is not read yet
+std::vector<cl::Event> oclEvents;
+#define OCL_PROFILE_BATCH 1024 // read in batches while the next batch keeps the device busy
+
+// adds the profiling info of the first count launches to Timing:
+//      ocl queue ms    queued until submitted to the device
+//      ocl launch ms   submitted until started
+//      ocl kernel ms   execution
+void oclProfile(size_t count)
 {
-	if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
-	std::ofstream out(filePath);
-	if (out.is_open())
+	if (count == 0) return;
+	oclEvents[count - 1].wait();
+	for (size_t i = 0; i < count; i++)
 	{
-		out << w << "," << h << std::endl;
-		for (unsigned int i = 0; i < total_elem_count; ++i)
-		{
-			if (drawNeighbours) out << (neighbours[i] + 0);
-			else out << ((cells[i] & STATE_ALIVE) ? "x" : ".");
-
-			if (i % w == w - 1) out << std::endl;
-		}
+		cl_ulong queued = oclEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		cl_ulong submit = oclEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+		cl_ulong start = oclEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		cl_ulong end = oclEvents[i].getProfilingInfo<CL_PROFILING_COMMAND_END>();
+		Timing::getInstance()->addValue("ocl queue ms", (submit - queued) * 1e-6);
+		Timing::getInstance()->addValue("ocl launch ms", (start - submit) * 1e-6);
+		Timing::getInstance()->addValue("ocl kernel ms", (end - start) * 1e-6);
 	}
-	else std::cout << "Error opening " << filePath << std::endl;
+	oclEvents.erase(oclEvents.begin(), oclEvents.begin() + count);
+}
 
-	out.close();
+// enqueues a launch without waiting for it, the in-order queue keeps the generations in sequence
+void oclLaunch(const cl::Kernel& k, const cl::NDRange& global, const cl::NDRange& local)
+{
+	oclEvents.emplace_back();
+	queue.enqueueNDRangeKernel(k, cl::NullRange, global, local, 0, &oclEvents.back());
+	if (oclEvents.size() >= 2 * OCL_PROFILE_BATCH) oclProfile(OCL_PROFILE_BATCH);
 }
 
-void initOCL(unsigned int platformId, unsigned int deviceId)
+// a board due for a checkpoint or the frame stream is read back without waiting for it,
+// it is handed over when the next one is due or in finalization, so the device keeps calculating
+struct OclSnapshot
 {
-	cl::Program program;
-	std::vector<cl::Device> devices;
+	bool pending = false;
+	unsigned int gens = 0;
+	bool checkpoint = false;
+	bool emit = false;
+	cl::Event read;
+};
+OclSnapshot oclSnapshot;
+std::vector<unsigned char> oclStaging;
+
+void oclDeliver()
+{
+	if (!oclSnapshot.pending) return;
+	oclSnapshot.read.wait();
+	if (oclSnapshot.checkpoint) checkpointer.submit(oclSnapshot.gens, oclStaging.data());
+	if (oclSnapshot.emit) emitter.submit(oclSnapshot.gens, oclStaging.data());
+	oclSnapshot.pending = false;
+}
+
+// called after gens generations of this run with the buffer holding that board
+void oclAfter(unsigned int gens, const cl::Buffer& current)
+{
+	bool checkpoint = checkpointer.due(gens);
+	bool emit = emitter.due(gens);
+	if (!checkpoint && !emit) return;
+
+	oclDeliver(); // frees the staging buffer
+	oclStaging.resize(total_elem_count);
+	oclSnapshot.pending = true;
+	oclSnapshot.gens = gens;
+	oclSnapshot.checkpoint = checkpoint;
+	oclSnapshot.emit = emit;
+	queue.enqueueReadBuffer(current, CL_FALSE, 0, sizeof(unsigned char) * total_elem_count, oclStaging.data(), 0, &oclSnapshot.read);
+	queue.flush();
+}
+
+// --ocl-kernel plain: one work-item per cell, one launch per generation, returns the count of launches
+unsigned int runPlain(unsigned int generations)
+{
+	for (unsigned int gen = 0; gen < generations; gen++)
+	{
+		oclLaunch(kernels[gen % 2], cl::NDRange(total_elem_count), cl::NullRange);
+		oclAfter(gen + 1, (gen % 2 == 0) ? cacheBuffer : boardBuffer);
+	}
+	return generations;
+}
 
+// true if the platform exists and has a device, e.g. to include ocl in the bench
+bool oclAvailable(unsigned int platformId)
+{
 	try
 	{
-		// get available platforms ( NVIDIA, Intel, AMD,...)
 		std::vector<cl::Platform> platforms;
 		cl::Platform::get(&platforms);
-		if (platforms.size() == 0 || platforms.size() < platformId) throw "specified OpenCL platform not available!";
+		if (platforms.size() <= platformId) return false;
+		std::vector<cl::Device> devices;
+		platforms[platformId].getDevices(CL_DEVICE_TYPE_ALL, &devices);
+		return !devices.empty();
+	}
+	catch (cl::Error&)
+	{
+		return false;
+	}
+}
 
-#ifdef _DEBUG
-		// test output to gather information about installed hardware:
-		// SyntaX-Desktop:
-		//	platform: NVIDIA CUDA
-		//		device: GeForce GTX 1080
-		//	platform: Intel(R) OpenCL HD Graphics
-		//		device : Intel(R) HD Graphics 530
-		for (auto& platform : platforms)
+// --ocl-kernel tiled: 2D work-groups advance their tile oclBlock generations in local memory per launch,
+// returns the count of launches
+unsigned int runTiled(unsigned int generations, unsigned int oclBlock)
+{
+	size_t tileW = OCL_TILE_W;
+	size_t tileH = OCL_TILE_H;
+	size_t maxGroup = tiledKernels[0].getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+	while (tileW * tileH > maxGroup && tileW * tileH > 1)
+	{
+		if (tileH >= tileW) tileH /= 2;
+		else tileW /= 2;
+	}
+	size_t localMem = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	if (2 * (tileW + 2 * oclBlock) * (tileH + 2 * oclBlock) > localMem)
+	{
+		std::cerr << "--ocl-block " << oclBlock << " needs more local memory than the device provides (" << localMem << " bytes)" << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	if (debugOutput) std::cout << "tiled kernel: work-group " << tileW << "x" << tileH << ", " << oclBlock << " generations per launch" << std::endl;
+
+	// round up to whole work-groups, the kernel skips the cells outside of the board
+	cl::NDRange global((w + tileW - 1) / tileW * tileW, (h + tileH - 1) / tileH * tileH);
+	cl::NDRange local(tileW, tileH);
+	unsigned int step = 0;
+	unsigned int launches = 0;
+	for (unsigned int gen = 0; gen < generations; launches++)
+	{
+		// the last launch and the ones ending at a checkpoint or frame may advance fewer
+		// generations, arguments are taken at enqueue
+		unsigned int count = emitter.limit(gen, checkpointer.limit(gen, std::min(oclBlock, generations - gen)));
+		if (step != count)
 		{
-			std::cout << "platform: " << platform.getInfo<CL_PLATFORM_NAME>() << "\n";
-			//cl_context_properties properties[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)(platform)(), 0 };
-			//cl::Context context(CL_DEVICE_TYPE_ALL, properties);
-			//devices = context.getInfo<CL_CONTEXT_DEVICES>();
-			platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-			for (auto& device : devices)
+			step = count;
+			for (int i = 0; i < 2; i++)
 			{
-				std::cout << "device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
+				tiledKernels[i].setArg(4, step);
+				tiledKernels[i].setArg(5, cl::Local(2 * (tileW + 2 * step) * (tileH + 2 * step)));
 			}
 		}
-#endif
-
-		// create a context and get available devices
-		cl::Platform platform = platforms[platformId];
-		if (debugOutput) std::cout << "using platform: " << platform.getInfo<CL_PLATFORM_NAME>() << "\n";
 
-		platform.getDevices(CL_DEVICE_TYPE_ALL, &devices);
-		if (devices.size() == 0 || devices.size() < deviceId) throw "specified OpenCL device not available!";
-
-		cl::Device device = devices[deviceId];
-		if (debugOutput) std::cout << "using device: " << device.getInfo<CL_DEVICE_NAME>() << "\n";
-
-		cl::Context context({ device });
-	 	cl::Program::Sources sources;
-
-		// load and build the kernel
-		std::ifstream sourceFile(KERNEL_FILE);
-		if (!sourceFile) std::cerr << "kernel source file " << KERNEL_FILE << " not found!" << std::endl;
-
-		std::string sourceCode(
-			std::istreambuf_iterator<char>(sourceFile),
-			(std::istreambuf_iterator<char>()));
-		cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length() + 1));
-		program = cl::Program(context, source);
-		//program.build(devices);
-		if (program.build({ device }) != CL_SUCCESS) std::cerr << " Error building: " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
-
-		// init buffer and Kernel
-		boardBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(unsigned char) * total_elem_count);
-		cacheBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(unsigned char) * total_elem_count);
-
-		kernel = cl::Kernel(program, "gol_generation");
-
-		queue = cl::CommandQueue(context, device);
-		// TODO: check for Copy/Read Buffer
-		queue.enqueueWriteBuffer(boardBuffer, CL_TRUE, 0, sizeof(unsigned char) * total_elem_count, cells);
-		queue.enqueueWriteBuffer(cacheBuffer, CL_TRUE, 0, sizeof(unsigned char) * total_elem_count, oldCells);
-	}
-	catch (cl::Error err)
-	{
-		std::string s;
-		program.getBuildInfo(devices[deviceId], CL_PROGRAM_BUILD_LOG, &s);
-		std::cout << s << std::endl;
-		program.getBuildInfo(devices[deviceId], CL_PROGRAM_BUILD_OPTIONS, &s);
-		std::cout << s << std::endl;
-		std::cerr << "ERROR: " << err.what() << "(" << err.err() << ")" << std::endl;
+		oclLaunch(tiledKernels[launches % 2], global, local);
+		gen += step;
+		oclAfter(gen, (launches % 2 == 0) ? cacheBuffer : boardBuffer);
 	}
+	return launches;
 }
 
-void runOCL(const char* fileI, const char* fileO, unsigned int generations, unsigned int platformId, unsigned int deviceId)
+void runOCL(const char* fileI, const char* fileO, unsigned int generations, unsigned int platformId, unsigned int deviceId, const std::string& oclKernel, unsigned int oclBlock)
 {
 #ifdef _DEBUG
 	if (debugOutput) std::cout << "DEBUG" << std::endl;
 #endif
 	if (debugOutput) std::cout << "running mode: ocl" << std::endl;
+	if (oclKernel != "plain" && oclKernel != "tiled")
+	{
+		std::cerr << "unknown --ocl-kernel " << oclKernel << ", possible values are plain and tiled" << std::endl;
+		exit(EXIT_FAILURE);
+	}
 
 	// init grid from file
 	Timing::getInstance()->startSetup();
-	ompReadFromFile(fileI);
-
-	// make an array for saving previous state
-	oldCells = new unsigned char[total_elem_count];
+	if (!checkpointer.load(fileI, LAYOUT_BYTES, generations)) exit(EXIT_FAILURE);
+	if (!emitter.start(LAYOUT_BYTES, cells)) exit(EXIT_FAILURE);
 
 	initOCL(platformId, deviceId);
-
-	unsigned int gen = 0;
 	Timing::getInstance()->stopSetup();
 
+	// all generations are enqueued back to back, the host only waits for the device at the end
 	Timing::getInstance()->startComputation();
-	for (gen = 0; gen < generations; gen++)
-	{
-		kernel.setArg(0, boardBuffer);
-		kernel.setArg(1, cacheBuffer);
-		kernel.setArg(2, w);
-		kernel.setArg(3, h);
-
-		// TODO: check if needed every gen?
-		queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(total_elem_count), cl::NullRange);
-		queue.finish();
-
-		std::swap(boardBuffer, cacheBuffer);
-	}
-	// read back current board state
-	queue.enqueueReadBuffer(boardBuffer, CL_TRUE, 0, sizeof(unsigned char) * total_elem_count, cells);
+	unsigned int launches = (oclKernel == "tiled") ? runTiled(generations, std::max(oclBlock, 1u)) : runPlain(generations);
+	queue.finish();
 	Timing::getInstance()->stopComputation();
+	board_generation += generations;
 
-	// write out result
+	// read back current board state and write out result
 	Timing::getInstance()->startFinalization();
-	oclWriteToFile(fileO);
-	//writeToFile(fileO, true); // writes count of neighbours instead of just x / .
+	oclDeliver();
+	oclProfile(oclEvents.size());
+	const cl::Buffer& result = (launches % 2 == 0) ? boardBuffer : cacheBuffer;
+	void* mapped = queue.enqueueMapBuffer(result, CL_TRUE, CL_MAP_READ, 0, sizeof(unsigned char) * total_elem_count);
+	BoardView board = currentBoard();
+	board.cells = (const unsigned char*)mapped;
+	saveBoard(fileO, LAYOUT_BYTES, board); // formats straight from the mapping, unmapped once written
+	if (oclKeepResult) memcpy(cells, mapped, sizeof(unsigned char) * total_elem_count);
+	queue.enqueueUnmapMemObject(result, mapped);
+	checkpointer.finish();
+	emitter.finish();
 	Timing::getInstance()->stopFinalization();
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+ocl program:
+builds kernel.cl for a device, shared by ocl mode and the ocl engine of the
+library (golEngine.h), so both use the same build options and binary cache.
+
+built programs are cached on disk, compiling kernel.cl from source takes most of the setup:
+	<cache folder>/kernel_<hash of key>.bin: OCL_CACHE_MAGIC, uint32 key size, key, uint64 binary size, binary
+the key holds platform, device, driver version, build options and a hash of the source,
+a stored binary is only used if its key matches and the driver accepts it.
+
+--------------------------------------------------------------------------- */
+
+#include "rule.h"
+
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#define CL_TARGET_OPENCL_VERSION 220
+#define __CL_ENABLE_EXCEPTIONS // to use cl::Error
+#include <CL/cl.hpp>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define OCL_CACHE_MAGIC "GOLK"
+
+// fnv-1a
+inline uint64_t oclHash(const std::string& text)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+inline std::string oclCacheKey(const std::string& source, const std::string& options, const cl::Platform& platform, const cl::Device& device)
+{
+	std::ostringstream key;
+	key << platform.getInfo<CL_PLATFORM_NAME>() << "\n" << device.getInfo<CL_DEVICE_NAME>() << "\n" << device.getInfo<CL_DRIVER_VERSION>() << "\n"
+		<< options << "\n" << std::hex << oclHash(source) << "\n";
+	return key.str();
+}
+
+inline std::string oclCachePath(const std::string& cacheDir, const std::string& key)
+{
+	std::ostringstream path;
+	path << cacheDir << "/kernel_" << std::hex << oclHash(key) << ".bin";
+	return path.str();
+}
+
+// returns the binary stored for key, empty if there is none or it was built for another key
+inline std::vector<char> oclCacheLoad(const std::string& cacheDir, const std::string& key)
+{
+	std::vector<char> binary;
+	if (cacheDir.empty()) return binary;
+	std::ifstream file(oclCachePath(cacheDir, key), std::ios::binary);
+	if (!file) return binary;
+
+	char magic[4];
+	uint32_t keySize = 0;
+	uint64_t binarySize = 0;
+	file.read(magic, 4);
+	file.read((char*)&keySize, sizeof(keySize));
+	if (!file || memcmp(magic, OCL_CACHE_MAGIC, 4) != 0 || keySize != key.size()) return binary;
+	std::string stored(keySize, '\0');
+	file.read(&stored[0], keySize);
+	file.read((char*)&binarySize, sizeof(binarySize));
+	if (!file || stored != key || binarySize == 0 || binarySize > (1ull << 30)) return binary;
+
+	binary.resize(binarySize);
+	file.read(binary.data(), binarySize);
+	if (!file) binary.clear();
+	return binary;
+}
+
+// stores the binary of a built program, written to a temporary file and renamed so readers never see a partial entry
+inline void oclCacheStore(const std::string& cacheDir, const std::string& key, const cl::Program& program)
+{
+	if (cacheDir.empty()) return;
+	std::vector<size_t> sizes;
+	program.getInfo(CL_PROGRAM_BINARY_SIZES, &sizes);
+	if (sizes.size() != 1 || sizes[0] == 0) return;
+	std::vector<char> binary(sizes[0]);
+	std::vector<char*> binaries(1, binary.data());
+	program.getInfo(CL_PROGRAM_BINARIES, &binaries);
+
+	std::error_code error;
+	std::filesystem::create_directories(cacheDir, error);
+	std::string path = oclCachePath(cacheDir, key);
+	std::string temp = path + ".tmp";
+	{
+		std::ofstream file(temp, std::ios::binary);
+		uint32_t keySize = (uint32_t)key.size();
+		uint64_t binarySize = binary.size();
+		file.write(OCL_CACHE_MAGIC, 4);
+		file.write((const char*)&keySize, sizeof(keySize));
+		file.write(key.data(), key.size());
+		file.write((const char*)&binarySize, sizeof(binarySize));
+		file.write(binary.data(), binary.size());
+		if (!file)
+		{
+			std::cerr << "error writing " << temp << std::endl;
+			file.close();
+			std::filesystem::remove(temp, error);
+			return;
+		}
+	}
+	std::filesystem::rename(temp, path, error);
+}
+
+// build options of kernel.cl for a rule, it is compiled into the kernel
+inline std::string oclOptions(const Rule& rule)
+{
+	return "-D RULE_BIRTH=" + std::to_string(rule.birth) + " -D RULE_SURVIVE=" + std::to_string(rule.survive);
+}
+
+// builds source with options for device, from the binary cached in cacheDir if the driver accepts it
+// (empty disables the cache), hit tells if it was. throws cl::Error, a failed build prints its log
+inline cl::Program oclBuild(const cl::Context& context, const cl::Platform& platform, const cl::Device& device,
+	const std::string& source, const std::string& options, const std::string& cacheDir, bool& hit)
+{
+	std::string key = oclCacheKey(source, options, platform, device);
+	hit = false;
+
+	// prefer the cached binary, a driver may still reject it (e.g. after an update with the same version string)
+	std::vector<char> binary = oclCacheLoad(cacheDir, key);
+	if (!binary.empty())
+	{
+		try
+		{
+			cl::Program::Binaries binaries(1, std::make_pair((const void*)binary.data(), binary.size()));
+			cl::Program program(context, { device }, binaries);
+			program.build({ device }, options.c_str());
+			hit = true;
+			return program;
+		}
+		catch (cl::Error&)
+		{
+			std::cerr << "cached kernel " << oclCachePath(cacheDir, key) << " rejected, building from source" << std::endl;
+		}
+	}
+
+	cl::Program::Sources sources(1, std::make_pair(source.c_str(), source.length() + 1));
+	cl::Program program(context, sources);
+	try
+	{
+		program.build({ device }, options.c_str());
+	}
+	catch (cl::Error&)
+	{
+		std::string s;
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &s);
+		std::cout << s << std::endl;
+		program.getBuildInfo(device, CL_PROGRAM_BUILD_OPTIONS, &s);
+		std::cout << s << std::endl;
+		throw;
+	}
+	oclCacheStore(cacheDir, key, program);
+	return program;
+}
@@ -27,104 +27,261 @@ OpenMP processing depends very much on num of threads and parallelized ares:
   Windows:
     thread 8:   4803.61ms, 5382.75ms, 4057.27ms, 5070.67ms
 
+
+fused ping-pong:
+each generation is a single parallel pass which reads the current board and
+writes the next state directly into a second board (oldCells), afterwards
+both pointers are swapped. no neighbours array is needed anymore, so only
+2 bytes per cell are resident and there is one barrier per generation.
+
+
+activity tracking (--tiles <size>):
+the board is split into tiles of size x size cells. a cell can only change
+if one of its neighbours changed in the previous generation, so only tiles
+that changed last generation plus their 8 neighbouring tiles (wrapped at the
+borders) are recalculated. all tiles are active in the first generation.
+the number of active tiles per generation is recorded in Timing.
+
+
+temporal blocking (--time-block <K>):
+for boards bigger than the caches every generation streams the whole board
+through memory. with time blocking each thread copies a tile plus a halo of
+K cells (wrapped around like sumNeighbours) into two small scratch boards,
+advances them K generations in cache, the valid area shrinking by one cell
+per generation, and only writes back the inner tile. so the board is read
+and written once per K generations. takes precedence over --tiles.
+
+
+numa (--numa, --affinity): see numa.h.
+
 --------------------------------------------------------------------------- */
 
 #include "common.h"
 #include "omp.h" // need to have project settings C/C++ openMP enabled
-
-inline int sumNeighbours(unsigned char* ptr_cell, int yOffTop, int yOffBot, int xOffLeft, int xOffRight)
+#include "boardIO.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "numa.h"
+#include "cycle.h"
+#include "rule.h"
+#include "golStep.h" // stepCells, sumNeighbours
+
+// calculates cells [from, to) of a row for the next generation from src into dst,
+// returns != 0 if any of them changed
+template <typename R>
+inline unsigned char ompCells(const unsigned char* src, unsigned char* dst, int row, int from, int to, const R& rule)
 {
-    // just return the sum of states for all neighbours
-    return
-        *(ptr_cell + yOffTop + xOffLeft) +
-        *(ptr_cell + yOffTop) +
-        *(ptr_cell + yOffTop + xOffRight) +
-        *(ptr_cell + xOffLeft) +
-        *(ptr_cell + xOffRight) +
-        *(ptr_cell + yOffBot + xOffLeft) +
-        *(ptr_cell + yOffBot) +
-        *(ptr_cell + yOffBot + xOffRight);
+    return stepCells(src, dst, w, h, row, from, to, rule);
 }
 
-void ompReadFromFile(const char* filePath)
+template <typename R>
+void ompGeneration(const unsigned char* src, unsigned char* dst, const R& rule)
 {
-    if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
-    std::ifstream in(filePath);
-    if (in.is_open())
+    // index variable must have signed type
+    int height = (int)h;
+    int row = 0;
+#pragma omp parallel
     {
-        std::string line;
-        std::getline(in, line); // get first line for explizit w / h
-
-        // TODO: better split
-        size_t pos = line.find(',');
-        if (pos != std::string::npos)
+        // share of each thread, without waiting for the others
+        TIMING_SCOPE("rows");
+#pragma omp for schedule(static) nowait
+        for (row = 0; row < height; row++)
         {
-            w = std::stoi(line.substr(0, pos));
-            h = std::stoi(line.substr(pos + 1));
+            ompCells(src, dst, row, 0, (int)w, rule);
         }
-        else // use default values
+    }
+}
+
+// one generation with the fixed bands of --numa (see numa.h), adds the time of each thread to threadMs
+template <typename R>
+void ompNumaGeneration(const unsigned char* src, unsigned char* dst, std::vector<double>& threadMs, const R& rule)
+{
+#pragma omp parallel
+    {
+        TIMING_SCOPE("band");
+        auto start = std::chrono::high_resolution_clock::now();
+        int t = omp_get_thread_num();
+        int from, to;
+        numaBand(t, omp_get_num_threads(), from, to);
+        for (int row = from; row < to; row++)
         {
-            w = 1000;
-            h = 10000;
+            ompCells(src, dst, row, 0, (int)w, rule);
         }
+        std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - start;
+        threadMs[t] += time.count();
+    }
+}
 
-        total_elem_count = w * h;
-        col_right = w - 1;
-        col_bot = total_elem_count - w;
-        row_bot = h - 1;
-        if (debugOutput) std::cout << "total: " << total_elem_count << ", w: " << w << ", h: " << h << std::endl;
-        if (debugOutput) std::cout << "col_right: " << col_right << ", col_bot: " << col_bot << ", row_bot: " << row_bot << std::endl;
-
-        cells = new unsigned char[total_elem_count];
-        memset(cells, 0, total_elem_count);
-
-        unsigned int idx = 0;
-        char c;
-        for (unsigned int y = 0; y < h; y++)
+// marks every tile that changed and its 8 neighbours (with wrap-around) as active
+int ompActivateTiles(const unsigned char* changed, unsigned char* active, int tilesX, int tilesY)
+{
+    memset(active, 0, (size_t)tilesX * tilesY);
+    for (int ty = 0; ty < tilesY; ty++)
+    {
+        for (int tx = 0; tx < tilesX; tx++)
         {
-            getline(in, line);
-            for (unsigned int x = 0; x < w; x++)
+            if (!changed[tx + ty * tilesX]) continue;
+
+            for (int dy = -1; dy <= 1; dy++)
             {
-                c = line[x];
-                //std::cout << "read c: " << c << " for index: " << idx << std::endl;
-                if (c == 'x')  // only need to set alive cells, otherwise stay 0
+                int y = (ty + dy + tilesY) % tilesY;
+                for (int dx = -1; dx <= 1; dx++)
                 {
-                    *(cells + idx) = STATE_ALIVE;
+                    active[(tx + dx + tilesX) % tilesX + y * tilesX] = 1;
                 }
+            }
+        }
+    }
 
-                if (++idx >= total_elem_count) break;
+    int count = 0;
+    for (int t = 0; t < tilesX * tilesY; t++) count += active[t];
+    return count;
+}
+
+// same as the generation loop in runOMP, but only for tiles marked as active.
+// an inactive tile did not change in the last step, so both boards already
+// hold the same state for it and it needs no copy.
+template <typename R>
+void ompRunTiled(unsigned int generations, int tileSize, const R& rule)
+{
+    int tilesX = (w + tileSize - 1) / tileSize;
+    int tilesY = (h + tileSize - 1) / tileSize;
+    unsigned char* active = new unsigned char[tilesX * tilesY];
+    unsigned char* changed = new unsigned char[tilesX * tilesY];
+    memset(active, 1, tilesX * tilesY);
+    std::vector<int> activeList;
+    activeList.reserve(tilesX * tilesY);
+
+    for (unsigned int gen = 0; gen < generations; gen++)
+    {
+        TIMING_SCOPE("generation");
+        activeList.clear();
+        for (int t = 0; t < tilesX * tilesY; t++)
+        {
+            if (active[t]) activeList.push_back(t);
+        }
+        Timing::getInstance()->addValue("active tiles", (double)activeList.size());
+
+        memset(changed, 0, tilesX * tilesY);
+        int count = (int)activeList.size();
+        int i;
+#pragma omp parallel for schedule(dynamic)
+        for (i = 0; i < count; i++)
+        {
+            TIMING_SCOPE("tile");
+            int x0 = (activeList[i] % tilesX) * tileSize;
+            int y0 = (activeList[i] / tilesX) * tileSize;
+            int x1 = std::min(x0 + tileSize, (int)w);
+            int y1 = std::min(y0 + tileSize, (int)h);
+            unsigned char diff = 0;
+            for (int row = y0; row < y1; row++)
+            {
+                diff |= ompCells(cells, oldCells, row, x0, x1, rule);
             }
+            changed[activeList[i]] = diff;
         }
+
+        std::swap(cells, oldCells);
+        checkpointer.after(gen + 1, cells);
+        emitter.after(gen + 1, cells);
+        gen += cycles.after(gen + 1, cells, generations);
+        ompActivateTiles(changed, active, tilesX, tilesY);
     }
-    else std::cout << "error opening " << filePath << std::endl;
 
-    if (!in.eof() && in.fail())
-        std::cout << "error reading " << filePath << std::endl;
+    delete[] active;
+    delete[] changed;
+}
+
+#define TIME_BLOCK_TILE 256 // inner tile size for temporal blocking
 
-    in.close();
+// one generation on a scratch board without wrap-around, for rows [rowFrom, rowTo)
+// and cols [colFrom, colTo) of a board with the given stride
+template <typename R>
+inline void ompPlaneGeneration(const unsigned char* src, unsigned char* dst, int stride, int rowFrom, int rowTo, int colFrom, int colTo, const R& rule)
+{
+    for (int row = rowFrom; row < rowTo; row++)
+    {
+        const unsigned char* cur = src + row * stride;
+        unsigned char* out = dst + row * stride;
+        for (int col = colFrom; col < colTo; col++)
+        {
+            int countNeighbours = sumNeighbours(cur + col, -stride, stride, -1, 1);
+            out[col] = rule.next(cur[col], countNeighbours);
+        }
+    }
 }
 
-void ompWriteToFile(const char* filePath, bool drawNeighbours = false)
+template <typename R>
+void ompRunTimeBlocked(unsigned int generations, int blockGens, const R& rule)
 {
-    if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
-    std::ofstream out(filePath);
-    if (out.is_open())
+    int tilesX = (w + TIME_BLOCK_TILE - 1) / TIME_BLOCK_TILE;
+    int tilesY = (h + TIME_BLOCK_TILE - 1) / TIME_BLOCK_TILE;
+    int tiles = tilesX * tilesY;
+
+    for (unsigned int gen = 0; gen < generations;)
     {
-        out << w << "," << h << std::endl;
-        for (unsigned int i = 0; i < total_elem_count; ++i)
+        TIMING_SCOPE("generations");
+        // a block ends at the next checkpoint or frame instead of passing it
+        int halo = (int)emitter.limit(gen, checkpointer.limit(gen, std::min(generations - gen, (unsigned int)blockGens)));
+        int size = TIME_BLOCK_TILE + 2 * halo;
+
+#pragma omp parallel
         {
-            if (drawNeighbours) out << (neighbours[i] + 0);
-            else out << ((cells[i] & STATE_ALIVE) ? "x" : ".");
+            // scratch boards are reused for all tiles of a thread
+            std::vector<unsigned char> bufA((size_t)size * size);
+            std::vector<unsigned char> bufB((size_t)size * size);
+
+            int t;
+#pragma omp for schedule(dynamic)
+            for (t = 0; t < tiles; t++)
+            {
+                TIMING_SCOPE("tile");
+                int x0 = (t % tilesX) * TIME_BLOCK_TILE;
+                int y0 = (t / tilesX) * TIME_BLOCK_TILE;
+                int tileW = std::min(TIME_BLOCK_TILE, (int)w - x0);
+                int tileH = std::min(TIME_BLOCK_TILE, (int)h - y0);
+                unsigned char* src = bufA.data();
+                unsigned char* dst = bufB.data();
+
+                // copy tile with halo, wrapping around at the borders (halo may be larger than the board)
+                int rows = tileH + 2 * halo;
+                int cols = tileW + 2 * halo;
+                for (int row = 0; row < rows; row++)
+                {
+                    int y = ((y0 + row - halo) % (int)h + (int)h) % (int)h;
+                    int col = 0;
+                    while (col < cols)
+                    {
+                        int x = ((x0 + col - halo) % (int)w + (int)w) % (int)w;
+                        int len = std::min(cols - col, (int)w - x);
+                        memcpy(src + row * size + col, cells + y * w + x, len);
+                        col += len;
+                    }
+                }
 
-            if (i % w == w - 1) out << std::endl;
+                for (int g = 1; g <= halo; g++)
+                {
+                    ompPlaneGeneration(src, dst, size, g, rows - g, g, cols - g, rule);
+                    std::swap(src, dst);
+                }
+
+                // only the inner tile is valid after halo generations
+                for (int row = 0; row < tileH; row++)
+                {
+                    memcpy(oldCells + (y0 + row) * w + x0, src + (row + halo) * size + halo, tileW);
+                }
+            }
         }
-    }
-    else std::cout << "Error opening " << filePath << std::endl;
 
-    out.close();
+        std::swap(cells, oldCells);
+        checkpointer.after(gen + halo, cells);
+        emitter.after(gen + halo, cells);
+        gen += halo + cycles.after(gen + halo, cells, generations);
+    }
 }
 
-void runOMP(const char* fileI, const char* fileO, unsigned int generations, int threads)
+void runOMP(const char* fileI, const char* fileO, unsigned int generations, int threads, int tileSize = 0, int blockGens = 0,
+    bool numa = false, const std::string& affinity = "none")
 {
 #ifdef _DEBUG
     if (debugOutput) std::cout << "DEBUG" << std::endl;
@@ -133,10 +290,14 @@ void runOMP(const char* fileI, const char* fileO, unsigned int generations, int
 
     // init grid from file
     Timing::getInstance()->startSetup();
-    ompReadFromFile(fileI);
-
-    // make an array for saving neighbour count for each cell
-    neighbours = new int[total_elem_count];
+    if (!checkpointer.load(fileI, LAYOUT_BYTES, generations)) exit(EXIT_FAILURE);
+    if (!emitter.start(LAYOUT_BYTES, cells)) exit(EXIT_FAILURE);
+    cycles.start(LAYOUT_BYTES, true);
+    if (affinity != "none" && affinity != "compact" && affinity != "spread")
+    {
+        std::cerr << "unknown --affinity " << affinity << ", possible values are none, compact and spread" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
     // OpenMP initializations
     // OMP_NUM_THREADS (environment variable) specifies initially the number of threads
@@ -149,86 +310,52 @@ void runOMP(const char* fileI, const char* fileO, unsigned int generations, int
     if (threads != num_threads) omp_set_num_threads(threads);
     if (debugOutput) std::cout << "number of processors: " << omp_get_num_procs() << ", set number of threads: " << threads << std::endl;
 
-    // index variable must have signed type
-    int height = (int)h;
-    int elems = (int)total_elem_count;
-    int row = 0;
-    int col = 0;
-    int idx = 0;
-    unsigned int gen = 0;
-    int value = 0;
-    int countNeighbours = 0;
-
-    int yOffTop = -(int)w;
-    int yOffBot = +(int)w;
-    int xOffLeft = -1;
-    int xOffRight = +1;
+    NumaTopology topology;
+    if (numa || affinity != "none") topology = numaTopology();
+    if (affinity != "none") numaPinThreads(topology, affinity);
+    numa = numa && blockGens == 0 && tileSize == 0;
+    std::vector<int> threadNodes;
+    std::vector<double> threadMs;
+    if (numa)
+    {
+        // both boards on the nodes of the threads computing their bands
+        unsigned char* placed = numaPlace(cells, topology, threadNodes);
+        delete[] cells;
+        cells = placed;
+        oldCells = numaPlace(cells, topology, threadNodes);
+        threadMs.assign(threadNodes.size(), 0);
+        if (debugOutput) std::cout << "numa: " << topology.nodes.size() << " nodes, " << threadNodes.size() << " bands" << std::endl;
+    }
+    else
+    {
+        // make a second board to write the next generation into, same content
+        // so that inactive tiles are valid in both
+        oldCells = new unsigned char[total_elem_count];
+        memcpy(oldCells, cells, total_elem_count);
+    }
     Timing::getInstance()->stopSetup();
-    
+
     Timing::getInstance()->startComputation();
-    for (gen = 0; gen < generations; gen++)
+    if (blockGens > 0) withRule(rule, [&](auto r) { ompRunTimeBlocked(generations, blockGens, r); });
+    else if (tileSize > 0) withRule(rule, [&](auto r) { ompRunTiled(generations, tileSize, r); });
+    else for (unsigned int gen = 0; gen < generations; gen++)
     {
-        // need to get current neighbour count, because other than seqMode updates are not diffs but full states
-        // first handle all cells without border mapping, afterwards special handling
-#pragma omp parallel for shared(neighbours) private(row, col) // TEST: use this and no inner loop: Win: 4631.35ms, Ubuntu 7405.71ms
-//#pragma omp parallel for collapse(2) shared(neighbours) private(row, col) // TEST: use this and no inner loop: Win: 4631.35ms, Ubuntu 7405.71ms
-        for (row = 0; row < height; row++)
-        {
-            yOffTop = (row == 0) ? col_bot : -(int)w;
-            yOffBot = (row == (h - 1)) ? -col_bot : w;
-
-//#pragma omp parallel for shared(neighbours) private(row, col) // TEST: use here and not for loop -> Win: segfault, Ubuntu: 6450ms
-            for (col = 1; col < col_right; col++)
-            {
-                idx = col + (row * w); // fastest way
-                *(neighbours + idx) = sumNeighbours(cells + idx, yOffTop, yOffBot, xOffLeft, xOffRight);
-            }
-
-            // handle border for x == 0
-            idx = (row * w);
-            *(neighbours + idx) = sumNeighbours(cells + idx, yOffTop, yOffBot, col_right, xOffRight);
-
-            // handle border for x == col_right
-            idx = col_right + (row * w);
-            *(neighbours + idx) = sumNeighbours(cells + idx, yOffTop, yOffBot, xOffLeft, -col_right);
-        }
-
-        // change cells dependent on oldCells
-#pragma omp parallel for shared(cells) private(idx)
-        for (idx = 0; idx < elems; ++idx)
-        {
-            value = *(cells + idx);
-            countNeighbours = *(neighbours + idx);
-
-            /*
-            // set new state depending on current state, only if changed
-            if (value == STATE_ALIVE)
-            {
-                // cell is alive -> check diese if less than 2 or more than 3 neighbours
-                if (countNeighbours < 2 || countNeighbours > 3)
-                {
-                    *(cells + idx) = STATE_DEAD;
-                }
-                // else // Ah, ha, ha, ha, stayin' alive, stayin' alive!
-            }
-            else if (countNeighbours == 3) // cell was dead and has enough neighbours -> newborn <3
-            {
-                *(cells + idx) = STATE_ALIVE;
-            }
-            */
-
-            // alternative option: always set value
-            *(cells + idx) = (countNeighbours == 3) + value * (countNeighbours == 2);
-            // TODO: check if logical operators are even faster?
-            //*(cells + idx) = (countNeighbours == 3) | value & (countNeighbours == 2);
-        }
+        TIMING_SCOPE("generation");
+        if (numa) withRule(rule, [&](auto r) { ompNumaGeneration(cells, oldCells, threadMs, r); });
+        else withRule(rule, [&](auto r) { ompGeneration(cells, oldCells, r); });
+        std::swap(cells, oldCells);
+        checkpointer.after(gen + 1, cells);
+        emitter.after(gen + 1, cells);
+        gen += cycles.after(gen + 1, cells, generations);
     }
-
     Timing::getInstance()->stopComputation();
+    board_generation += generations;
+    if (numa) numaReport(threadNodes, threadMs, generations);
 
     // write out result
     Timing::getInstance()->startFinalization();
-    ompWriteToFile(fileO);
-    //writeToFile(fileO, true); // writes count of neighbours instead of just x / .
+    saveBoard(fileO, LAYOUT_BYTES);
+    checkpointer.finish();
+    emitter.finish();
     Timing::getInstance()->stopFinalization();
-}
\ No newline at end of file
+}
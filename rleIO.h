@@ -0,0 +1,304 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+rle file io:
+the run length encoded pattern format used by golly and most pattern
+collections, selected by the extension ".rle":
+
+    #C optional comment lines
+    x = 5, y = 4, rule = B3/S23
+    bo$2bo$3o!
+
+the header gives the size of the board, the body lists runs of dead (b) and
+alive (o) cells, $ ends a row and ! ends the pattern; every tag may be
+prefixed by a count. cells missing at the end of a row or of the pattern are
+dead.
+
+the reader parses the mapped file in one pass and sets the runs directly in
+the layout of the mode (a memset per run of bytes, masks on whole words for
+bits, setCellState per live cell for seq), the writer scans each row for the
+next change of state: 8 cells per compare on bytes, one bit scan per run on
+bits. apart from clearing the board both take time proportional to the runs,
+not to the area.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "golIO.h" // MappedFile, emptyBoard, encodeNeighbours
+#include "rule.h"
+
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward64
+#endif
+
+#define RLE_LINE_LENGTH 70
+
+bool isRleFile(const char* filePath)
+{
+    std::string path(filePath);
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".rle") == 0;
+}
+
+// index of the lowest set bit, word must not be 0
+inline unsigned int rleLowestBit(uint64_t word)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return __builtin_ctzll(word);
+#endif
+}
+
+// parses "x = 5, y = 4, rule = B3/S23", returns false if x or y are missing
+bool parseRleHeader(const std::string& line, unsigned int& width, unsigned int& height, std::string& ruleText)
+{
+    width = 0;
+    height = 0;
+    size_t pos = 0;
+    while (pos < line.size())
+    {
+        size_t end = line.find(',', pos);
+        if (end == std::string::npos) end = line.size();
+        std::string item = line.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+        key.erase(std::remove_if(key.begin(), key.end(), ::isspace), key.end());
+        value.erase(std::remove_if(value.begin(), value.end(), ::isspace), value.end());
+
+        if (key == "x") width = (unsigned int)strtoul(value.c_str(), 0, 10);
+        else if (key == "y") height = (unsigned int)strtoul(value.c_str(), 0, 10);
+        else if (key == "rule") ruleText = value;
+    }
+    return width > 0 && height > 0;
+}
+
+// sets count cells starting at x alive in a row of bytes or of bits (the other one is 0),
+// the cells must be dead before
+inline void rleSetRun(unsigned char* bytes, uint64_t* row, unsigned int x, unsigned int count)
+{
+    if (bytes != 0) memset(bytes + x, STATE_ALIVE, count);
+    else
+    {
+        unsigned int end = x + count;
+        while (x < end)
+        {
+            unsigned int bit = x % 64;
+            unsigned int n = std::min(64 - bit, end - x);
+            uint64_t mask = (n == 64) ? ~0ULL : ((1ULL << n) - 1);
+            row[x / 64] |= mask << bit;
+            x += n;
+        }
+    }
+}
+
+// loads a .rle pattern into board.cells (bytes, seq) or board.bitCells (bits).
+// returns false and reports the reason if the file can not be read or is malformed
+bool loadRle(const char* filePath, GolLayout layout, BoardView& board)
+{
+    if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
+    MappedFile file;
+    if (!file.open(filePath))
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // skip comment lines, the first other line is the header
+    size_t pos = 0;
+    std::string headerLine;
+    while (pos < size)
+    {
+        const char* end = (const char*)memchr(data + pos, '\n', size - pos);
+        size_t next = end ? (size_t)(end - data) + 1 : size;
+        std::string line(data + pos, next - pos);
+        pos = next;
+        if (line.empty() || line[0] == '#' || line.find_first_not_of(" \t\r\n") == std::string::npos) continue;
+        headerLine = line;
+        break;
+    }
+
+    unsigned int width, height;
+    std::string patternRule;
+    if (!parseRleHeader(headerLine, width, height, patternRule))
+    {
+        std::cerr << "error reading " << filePath << ": missing or malformed header" << std::endl;
+        return false;
+    }
+    Rule parsed;
+    if (!patternRule.empty() && (!parseRule(patternRule, parsed) || parsed != rule))
+    {
+        std::cerr << "warning: " << filePath << " uses rule " << patternRule << ", simulated with " << ruleString(rule) << std::endl;
+    }
+
+    // seq gets the neighbour counts after the whole pattern is read
+    unsigned int words = (width + 63) / 64;
+    size_t count = (size_t)width * height;
+    unsigned char* bytes = 0;
+    uint64_t* bits = 0;
+    if (layout == LAYOUT_BITS)
+    {
+        bits = new uint64_t[(size_t)words * height];
+        memset(bits, 0, (size_t)words * height * sizeof(uint64_t));
+    }
+    else
+    {
+        bytes = new unsigned char[count];
+        memset(bytes, 0, count);
+    }
+
+    unsigned int x = 0;
+    unsigned int y = 0;
+    unsigned int run = 0;
+    bool ok = true;
+    for (; pos < size; pos++)
+    {
+        char c = data[pos];
+        if (c >= '0' && c <= '9')
+        {
+            if (run > (UINT32_MAX - 9) / 10)
+            {
+                std::cerr << "error reading " << filePath << ": run length too large" << std::endl;
+                ok = false;
+                break;
+            }
+            run = run * 10 + (c - '0');
+            continue;
+        }
+        if (c == '!') break;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+
+        unsigned int n = (run == 0) ? 1 : run;
+        run = 0;
+        if (c == '$')
+        {
+            y += n;
+            x = 0;
+            continue;
+        }
+
+        // b / . are dead, o and the letters of multi state patterns alive
+        bool dead = (c == 'b' || c == '.');
+        bool alive = (c == 'o' || (c >= 'A' && c <= 'X'));
+        if ((!dead && !alive) || n > width - x || (alive && y >= height))
+        {
+            std::cerr << "error reading " << filePath << ": malformed pattern in row " << y << std::endl;
+            ok = false;
+            break;
+        }
+        if (alive) rleSetRun(bytes ? bytes + (size_t)y * width : 0, bits ? bits + (size_t)y * words : 0, x, n);
+        x += n;
+    }
+    if (!ok)
+    {
+        delete[] bytes;
+        delete[] bits;
+        return false;
+    }
+
+    if (layout == LAYOUT_SEQ)
+    {
+        unsigned char* encoded = new unsigned char[count];
+        encodeNeighbours(bytes, encoded, width, height);
+        delete[] bytes;
+        bytes = encoded;
+    }
+    board = emptyBoard(width, height);
+    board.cells = bytes;
+    board.bitCells = bits;
+    return true;
+}
+
+// first x >= from in row y where the cell is (alive) or not (!alive), w if there is none
+inline unsigned int rleFindCell(const BoardView& board, GolLayout layout, unsigned int y, unsigned int from, bool alive)
+{
+    if (from >= board.w) return board.w;
+    if (layout == LAYOUT_BITS)
+    {
+        const uint64_t* row = board.bitCells + (size_t)y * board.words_per_row;
+        uint64_t flip = alive ? 0 : ~0ULL;
+        uint64_t word = (row[from / 64] ^ flip) & (~0ULL << (from % 64));
+        for (unsigned int k = from / 64;;)
+        {
+            if (word != 0) return std::min(k * 64 + rleLowestBit(word), board.w);
+            if (++k == board.words_per_row) return board.w;
+            word = row[k] ^ flip;
+        }
+    }
+
+    // skip 8 cells per compare while none of them has the state searched for
+    const unsigned char* row = board.cells + (size_t)y * board.w;
+    const uint64_t lsb = 0x0101010101010101ULL;
+    uint64_t other = alive ? 0 : lsb;
+    unsigned int x = from;
+    for (uint64_t word; x + 8 <= board.w; x += 8)
+    {
+        memcpy(&word, row + x, 8);
+        if ((word & lsb) != other) break;
+    }
+    while (x < board.w && (bool)(row[x] & STATE_ALIVE) != alive) x++;
+    return x;
+}
+
+// appends count tag to the body, breaking lines at RLE_LINE_LENGTH
+inline void rleAppend(std::string& out, size_t& lineStart, unsigned int count, char tag)
+{
+    char item[16];
+    int len = (count > 1) ? snprintf(item, sizeof(item), "%u%c", count, tag) : snprintf(item, sizeof(item), "%c", tag);
+    if (out.size() - lineStart + len > RLE_LINE_LENGTH)
+    {
+        out += '\n';
+        lineStart = out.size();
+    }
+    out.append(item, len);
+}
+
+// writes board as .rle pattern
+bool writeRle(const char* filePath, GolLayout layout, const BoardView& board)
+{
+    if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
+    std::string out = "x = " + std::to_string(board.w) + ", y = " + std::to_string(board.h) + ", rule = " + ruleString(rule) + "\n";
+    size_t lineStart = out.size();
+
+    // empty rows and dead cells at the end of a row are not written, the row ends
+    // are collected and emitted as one n$ before the next live cell
+    unsigned int pendingRows = 0;
+    for (unsigned int y = 0; y < board.h; y++)
+    {
+        unsigned int x = 0;
+        while (x < board.w)
+        {
+            unsigned int start = rleFindCell(board, layout, y, x, true);
+            if (start == board.w) break;
+            unsigned int end = rleFindCell(board, layout, y, start + 1, false);
+
+            if (pendingRows > 0) rleAppend(out, lineStart, pendingRows, '$');
+            pendingRows = 0;
+            if (start > x) rleAppend(out, lineStart, start - x, 'b');
+            rleAppend(out, lineStart, end - start, 'o');
+            x = end;
+        }
+        pendingRows++;
+    }
+    rleAppend(out, lineStart, 1, '!');
+    out += '\n';
+
+    FILE* file = fopen(filePath, "wb");
+    if (file == 0)
+    {
+        std::cerr << "error opening " << filePath << std::endl;
+        return false;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok) std::cerr << "error writing " << filePath << std::endl;
+    return ok;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+rules:
+--rule B3/S23 selects a life-like rule in B/S notation (the digits after B are
+the neighbour counts a dead cell is born with, after S the counts an alive
+cell survives with), S/B notation ("23/3") is accepted as well. the rule is
+stored as two bit masks, bit n for n neighbours, and written into .golb and
+.rle headers.
+
+the cpu engines get the rule as template parameter: withRule() calls its
+function with a StaticRule for the rules below, so their masks are
+constants and the compiler folds the rule into the hot loop (conway keeps the
+expressions it had before rules existed), every other rule runs with a
+DynamicRule reading the masks at runtime. ocl builds kernel.cl with the masks
+as -D RULE_BIRTH / RULE_SURVIVE.
+
+    B3/S23          conway
+    B36/S23         highlife
+    B3678/S34678    day & night
+    B2/S            seeds
+    B3/S012345678   life without death
+
+sparse and hashlife only look at cells near live ones, they can not run
+rules with B0 (dead cells without neighbours are born).
+
+also used by the library (golEngine.cpp, a translation unit of its own), so
+everything defined here is inline. the --rule setting itself is a global of
+common.h, the library gets its rule per engine (gol::Rule, golEngine.h).
+
+--------------------------------------------------------------------------- */
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#define RULE_CONWAY_BIRTH   (1 << 3)
+#define RULE_CONWAY_SURVIVE ((1 << 2) | (1 << 3))
+
+struct Rule
+{
+    uint16_t birth;     // bit n set: a dead cell with n neighbours is born
+    uint16_t survive;   // bit n set: an alive cell with n neighbours survives
+
+    bool operator==(const Rule& other) const { return birth == other.birth && survive == other.survive; }
+    bool operator!=(const Rule& other) const { return !(*this == other); }
+};
+
+// parses "B3/S23", "b3/s23" or "23/3" (survive / birth), returns false if malformed
+inline bool parseRule(const std::string& text, Rule& parsed)
+{
+    size_t slash = text.find('/');
+    if (slash == std::string::npos) return false;
+    std::string first = text.substr(0, slash);
+    std::string second = text.substr(slash + 1);
+
+    std::string birth, survive;
+    if (!first.empty() && (first[0] == 'B' || first[0] == 'b'))
+    {
+        if (second.empty() || (second[0] != 'S' && second[0] != 's')) return false;
+        birth = first.substr(1);
+        survive = second.substr(1);
+    }
+    else
+    {
+        survive = first;
+        birth = second;
+    }
+
+    Rule result = { 0, 0 };
+    for (char c : birth)
+    {
+        if (c < '0' || c > '8') return false;
+        result.birth |= 1 << (c - '0');
+    }
+    for (char c : survive)
+    {
+        if (c < '0' || c > '8') return false;
+        result.survive |= 1 << (c - '0');
+    }
+    parsed = result;
+    return true;
+}
+
+// "B3/S23"
+inline std::string ruleString(const Rule& r)
+{
+    std::string text = "B";
+    for (int n = 0; n <= 8; n++) if (r.birth & (1 << n)) text += (char)('0' + n);
+    text += "/S";
+    for (int n = 0; n <= 8; n++) if (r.survive & (1 << n)) text += (char)('0' + n);
+    return text;
+}
+
+typedef std::make_integer_sequence<int, 9> RuleCounts; // 0 .. 8 neighbours
+
+// rule with masks known at compile time
+template <uint16_t Birth, uint16_t Survive>
+struct StaticRule
+{
+    static constexpr uint16_t birth = Birth;
+    static constexpr uint16_t survive = Survive;
+    static constexpr bool conway = Birth == RULE_CONWAY_BIRTH && Survive == RULE_CONWAY_SURVIVE;
+
+    // counts a cell lives with either way, only when dead / only when alive
+    static constexpr uint16_t both = Birth & Survive;
+    static constexpr uint16_t bornOnly = Birth & ~Survive;
+    static constexpr uint16_t surviveOnly = Survive & ~Birth;
+
+    // 1 if count is one of the set bits of Mask: one compare per set bit ORed together,
+    // the same form as conway's, so the compiler vectorises the loops calling next()
+    template <uint16_t Mask, int... N>
+    static inline unsigned char matches(int count, std::integer_sequence<int, N...>)
+    {
+        return (unsigned char)(0 | ... | (((Mask >> N) & 1) ? (count == N) : 0));
+    }
+
+    // next state of a cell (0 / 1) with count alive neighbours, for conway (count == 3) | (alive & (count == 2))
+    static inline unsigned char next(unsigned char alive, int count)
+    {
+        return matches<both>(count, RuleCounts()) | (alive & matches<surviveOnly>(count, RuleCounts())) |
+            ((alive ^ 1) & matches<bornOnly>(count, RuleCounts()));
+    }
+};
+
+// any other rule, masks read at runtime
+struct DynamicRule
+{
+    uint16_t birth;
+    uint16_t survive;
+    static constexpr bool conway = false;
+
+    inline unsigned char next(unsigned char alive, int count) const
+    {
+        return ((birth | ((uint32_t)survive << 16)) >> (count + 16 * alive)) & 1;
+    }
+};
+
+typedef StaticRule<RULE_CONWAY_BIRTH, RULE_CONWAY_SURVIVE> ConwayRule;
+
+// calls f(r) with r the StaticRule of the given rule if it is pre-instantiated, a DynamicRule otherwise
+template <typename F>
+inline void withRule(const Rule& r, F&& f)
+{
+    if (r.birth == RULE_CONWAY_BIRTH && r.survive == RULE_CONWAY_SURVIVE) f(ConwayRule());
+    else if (r.birth == 0x048 && r.survive == 0x00C) f(StaticRule<0x048, 0x00C>());        // highlife
+    else if (r.birth == 0x1C8 && r.survive == 0x1D8) f(StaticRule<0x1C8, 0x1D8>());        // day & night
+    else if (r.birth == 0x004 && r.survive == 0x000) f(StaticRule<0x004, 0x000>());        // seeds
+    else if (r.birth == 0x008 && r.survive == 0x1FF) f(StaticRule<0x008, 0x1FF>());        // life without death
+    else f(DynamicRule{ r.birth, r.survive });
+}
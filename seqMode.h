@@ -11,6 +11,11 @@ on the generation, but calculaton and store was very imperformant.
 --------------------------------------------------------------------------- */
 
 #include "common.h"
+#include "boardIO.h"
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "cycle.h"
+#include "rule.h"
 
 void printCells()
 {
@@ -33,112 +38,58 @@ void printCells()
     }
 }
 
-inline void setCellState(unsigned char* ptr_cell, unsigned int x, unsigned int y, bool alive = true)
+// one generation: changes cells (state and neighbour counts) depending on oldCells
+template <typename R>
+void seqGeneration(const R& rule)
 {
-    // set cell value
-    *(ptr_cell) ^= STATE_ALIVE; // just toggle -> no if, saves about 500 ms
-
-    // calculate neighbours -> wrap-around at borders: { 0, 0 } is a neighbor of { m, n } on a m x n sized grid
-    // offsets in x,y direction
-#ifdef NO_IFS
-    int xOffLeft = col_right * (x == 0) + -1 * (x != 0);
-    int xOffRight = (-col_right * (x == col_right)) + 1 * (x != col_right);
-    int yOffTop = col_bot * (y == 0) + (-(int)w * (y != 0));
-    int yOffBot = (y == (h - 1)) ? -col_bot : w; // need to cast to int because of negative sign
-#else
-    int xOffLeft = (x == 0) ? col_right : -1;
-    int xOffRight = (x == col_right) ? -col_right : 1;
-    int yOffTop = (y == 0) ? col_bot : -(int)w;
-    int yOffBot = (y == (h - 1)) ? -col_bot : w; // need to cast to int because of negative sign
-#endif
-
-    // add bits for neighbour counts -> performs a diff!
-    int val = (alive) * 0x02 + (!alive) * -0x02;
-    *(ptr_cell + yOffTop + xOffLeft) += val;
-    *(ptr_cell + yOffTop) += val;
-    *(ptr_cell + yOffTop + xOffRight) += val;
-    *(ptr_cell + xOffLeft) += val;
-    *(ptr_cell + xOffRight) += val;
-    *(ptr_cell + yOffBot + xOffLeft) += val;
-    *(ptr_cell + yOffBot) += val;
-    *(ptr_cell + yOffBot + xOffRight) += val;
-}
+    unsigned int row = 0;
+    unsigned int col = 0;
+    unsigned int idx = 0;
+    char value = 0;
+    unsigned int countNeighbours = 0;
 
-void readFromFile(const char* filePath)
-{
-    if (debugOutput) std::cout << "read file: " << filePath << "..." << std::endl;
-    std::ifstream in(filePath);
-    if (in.is_open())
+    // change cells dependent on oldCells
+//#pragma omp parallel for private(row, col) //shared(cells, oldCells) // with this able to reduce runtime down to 4 sec for set_threads(8)
+    for (row = 0; row < h; row++)
     {
-        std::string line;
-        std::getline(in, line); // get first line for explizit w / h definition
-
-        // TODO: better split
-        size_t pos = line.find(',');
-        if (pos != std::string::npos)
+        for (col = 0; col < w; col++)
         {
-            w = std::stoi(line.substr(0, pos));
-            h = std::stoi(line.substr(pos + 1));
-        }
-        else // use default values
-        {
-            w = 1000;
-            h = 10000;
-        }
+            //idx++; // in every continue
+            //if (i > 0 || j > 0) idx++;
+            idx = col + (row * w); // fastest way
 
-        total_elem_count = w * h;
-        col_right = w - 1;
-        col_bot = total_elem_count - w;
-        if (debugOutput) std::cout << "total: " << total_elem_count << ", w: " << w << ", h: " << h << std::endl;
-        if (debugOutput) std::cout << "col_right: " << col_right << ", col_bot: " << col_bot << ", row_bot: " << row_bot << std::endl;
+            value = *(oldCells + idx);
+            //if (value == 0) continue; // this should be the main performance gain as it skips most of the cells after some time
+                                        // but without this if, execution time is even faster oO
+                                        // --> which means, as every cell has to be touched no need for memcpying the whole array but handling only diffs
 
-        cells = new unsigned char[total_elem_count];
-        memset(cells, 0, total_elem_count);
+            countNeighbours = (value >> 1);
 
-        unsigned int idx = 0;
-        char c;
-        for (unsigned int y = 0; y < h; y++)
-        {
-            std::getline(in, line);
-            for (unsigned int x = 0; x < w; x++)
+            // refactored to not using ifs and set value to 1 (new) -1 (die) 0 (let)
+            // --> is a few seconds slower than ifs
+            /*bool born = !(value & STATE_ALIVE) && (countNeighbours == 3); // Ah, ha, ha, ha, stayin' alive, stayin' alive!
+            bool die = (value & STATE_ALIVE) && !(countNeighbours == 2 || countNeighbours == 3); // x_x
+            setCellState(cells + idx, i, j, (born * 1 + die * -1) != 0);*/
+
+            // set new state depending on current state, only if changed
+            if (value & STATE_ALIVE)
             {
-                c = line[x];
-                //std::cout << "read c: " << c << " for index: " << idx << std::endl;
-                if (c == 'x')  // only need to set alive cells, otherwise stay 0
+                // cell is alive -> check diese if it does not have a surviving count (conway: less than 2 or more than 3 neighbours)
+                if (!rule.next(1, countNeighbours))
                 {
-                    setCellState(cells + idx, x, y, 1);
+                    setCellState(cells + idx, col, row, false); // x_x
                 }
-
-                if (++idx >= total_elem_count) break;
+                // else // Ah, ha, ha, ha, stayin' alive, stayin' alive!
+            }
+            else if (rule.next(0, countNeighbours)) // cell was dead and has enough neighbours -> newborn <3
+            {
+                setCellState(cells + idx, col, row, true);
             }
-        }
-    }
-    else std::cout << "error opening " << filePath << std::endl;
-
-    if (!in.eof() && in.fail())
-        std::cout << "error reading " << filePath << std::endl;
-
-    in.close();
-}
-
-void writeToFile(const char* filePath, bool drawNeighbours = false)
-{
-    if (debugOutput) std::cout << "write file: " << filePath << "..." << std::endl;
-    std::ofstream out(filePath);
-    if (out.is_open())
-    {
-        out << w << "," << h << std::endl;
-        for (unsigned int i = 0; i < total_elem_count; ++i)
-        {
-            if (drawNeighbours) out << ((cells[i] >> 1) + 0);
-            else out << ((cells[i] & STATE_ALIVE) ? "x" : ".");
 
-            if (i % w == w - 1) out << std::endl;
+            // alternative option: always set value (not applicable in this version because handling depending diffs)
+            //setCellState(cells + idx, col, row, (countNeighbours == 3) + (value & STATE_ALIVE) * (countNeighbours == 2));
         }
     }
-    else std::cout << "Error opening " << filePath << std::endl;
-
-    out.close();
 }
 
 void runSeq(const char* fileI, const char* fileO, unsigned int generations)
@@ -150,7 +101,9 @@ void runSeq(const char* fileI, const char* fileO, unsigned int generations)
 
     // init grid from file
     Timing::getInstance()->startSetup();
-    readFromFile(fileI);
+    if (!checkpointer.load(fileI, LAYOUT_SEQ, generations)) exit(EXIT_FAILURE);
+    if (!emitter.start(LAYOUT_SEQ, cells)) exit(EXIT_FAILURE);
+    cycles.start(LAYOUT_SEQ, false);
 
     // make a copy of cells to read from without interfering with current board
     oldCells = new unsigned char[total_elem_count];
@@ -164,17 +117,13 @@ void runSeq(const char* fileI, const char* fileO, unsigned int generations)
     std::string str;
 #endif
 
-    unsigned int row = 0;
-    unsigned int col = 0;
-    unsigned int idx = 0;
-    char value = 0;
-    unsigned int countNeighbours = 0;
     Timing::getInstance()->stopSetup();
 
     // actual sim loop
     Timing::getInstance()->startComputation();
     for (gen = 0; gen < generations; gen++)
     {
+        TIMING_SCOPE("generation");
         // copy current state in oldstate
         memcpy(oldCells, cells, total_elem_count);
 
@@ -182,48 +131,7 @@ void runSeq(const char* fileI, const char* fileO, unsigned int generations)
         //*oldCells = *cells;
         //memset(oldCells, 0, total_elem_count);
 
-        // change cells dependent on oldCells
-//#pragma omp parallel for private(row, col) //shared(cells, oldCells) // with this able to reduce runtime down to 4 sec for set_threads(8)
-        for (row = 0; row < h; row++)
-        {
-            for (col = 0; col < w; col++)
-            {
-                //idx++; // in every continue
-                //if (i > 0 || j > 0) idx++;
-                idx = col + (row * w); // fastest way
-
-                value = *(oldCells + idx);
-                //if (value == 0) continue; // this should be the main performance gain as it skips most of the cells after some time
-                                            // but without this if, execution time is even faster oO
-                                            // --> which means, as every cell has to be touched no need for memcpying the whole array but handling only diffs
-
-                countNeighbours = (value >> 1);
-
-                // refactored to not using ifs and set value to 1 (new) -1 (die) 0 (let)
-                // --> is a few seconds slower than ifs
-                /*bool born = !(value & STATE_ALIVE) && (countNeighbours == 3); // Ah, ha, ha, ha, stayin' alive, stayin' alive!
-                bool die = (value & STATE_ALIVE) && !(countNeighbours == 2 || countNeighbours == 3); // x_x
-                setCellState(cells + idx, i, j, (born * 1 + die * -1) != 0);*/
-
-                // set new state depending on current state, only if changed
-                if (value & STATE_ALIVE)
-                {
-                    // cell is alive -> check diese if less than 2 or more than 3 neighbours
-                    if (countNeighbours < 2 || countNeighbours > 3)
-                    {
-                        setCellState(cells + idx, col, row, false); // x_x
-                    }
-                    // else // Ah, ha, ha, ha, stayin' alive, stayin' alive!
-                }
-                else if (countNeighbours == 3) // cell was dead and has enough neighbours -> newborn <3
-                {
-                    setCellState(cells + idx, col, row, true);
-                }
-
-                // alternative option: always set value (not applicable in this version because handling depending diffs)
-                //setCellState(cells + idx, col, row, (countNeighbours == 3) + (value & STATE_ALIVE) * (countNeighbours == 2));
-            }
-        }
+        withRule(rule, [](auto r) { seqGeneration(r); });
 
 #ifdef SHOW_GENS
         printCells();
@@ -233,19 +141,17 @@ void runSeq(const char* fileI, const char* fileO, unsigned int generations)
         std::getline(std::cin, str);
 #endif
 
-        /*if (gen == 1 || gen == 10 || gen == 100 || gen == 250 || gen == 500 || gen == 1000)
-        {
-            std::string filename = "out" + std::to_string(gen) + "neighbors.out";
-            writeToFile(filename.c_str(), true);
-            filename = "out" + std::to_string(gen) + ".out";
-            writeToFile(filename.c_str());
-        }*/
+        checkpointer.after(gen + 1, cells);
+        emitter.after(gen + 1, cells);
+        gen += cycles.after(gen + 1, cells, generations);
     }
     Timing::getInstance()->stopComputation();
+    board_generation += generations;
 
     // write out result
     Timing::getInstance()->startFinalization();
-    writeToFile(fileO);
-    //writeToFile(fileO, true); // writes count of neighbours instead of just x / .
+    saveBoard(fileO, LAYOUT_SEQ);
+    checkpointer.finish();
+    emitter.finish();
     Timing::getInstance()->stopFinalization();
 }
\ No newline at end of file
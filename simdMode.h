@@ -0,0 +1,289 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+simd mode:
+byte per cell board like ompMode, but the interior of each row is computed
+16 / 32 / 64 cells at a time with explicit SSE2 / AVX2 / AVX-512 intrinsics:
+the three rows are loaded shifted by -1, 0, +1, the eight neighbour vectors are
+added bytewise and the rule is applied by compare and mask, so the next state
+is written in the same pass like in ompMode. conway compares with 2 and 3,
+other rules (--rule) compare with every count of their birth / survive masks.
+
+the instruction set is picked at runtime via cpuid (or forced by --simd), the
+wrap columns x == 0 / x == col_right and the tail of each row that does not
+fill a whole vector are handled by the scalar ompCells. board and buffer are
+swapped after every generation.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "ompMode.h" // ompCells
+#include "checkpoint.h"
+#include "framesIO.h"
+#include "cycle.h"
+#include "rule.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h> // __cpuid, _xgetbv
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+enum SimdLevel
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 16,
+    SIMD_AVX2 = 32,
+    SIMD_AVX512 = 64
+};
+
+// highest instruction set supported by cpu and os
+SimdLevel simdDetect()
+{
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool avx2 = false;
+    bool avx512 = false;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x06) == 0x06;
+        avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0 && (xcr0 & 0xE6) == 0xE6; // F + BW, zmm state
+    }
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+    bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    if (avx512) return SIMD_AVX512;
+    if (avx2) return SIMD_AVX2;
+    if (sse2) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+SimdLevel simdParse(const std::string& name)
+{
+    if (name == "sse2") return SIMD_SSE2;
+    if (name == "avx2") return SIMD_AVX2;
+    if (name == "avx512") return SIMD_AVX512;
+    return SIMD_SCALAR;
+}
+
+const char* simdName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+// each vector kernel computes the interior cols [1, end) of a row and returns end
+#ifdef SIMD_X86
+template <typename R>
+SIMD_TARGET("sse2")
+int simdRowSSE2(const unsigned char* up, const unsigned char* cur, const unsigned char* down, unsigned char* dst, const R& rule)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i three = _mm_set1_epi8(3);
+    int x = 1;
+    for (; x + 16 <= col_right; x += 16)
+    {
+        __m128i n = _mm_add_epi8(_mm_loadu_si128((const __m128i*)(up + x - 1)), _mm_loadu_si128((const __m128i*)(up + x)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(up + x + 1)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(cur + x - 1)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(cur + x + 1)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(down + x - 1)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(down + x)));
+        n = _mm_add_epi8(n, _mm_loadu_si128((const __m128i*)(down + x + 1)));
+        __m128i alive = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(cur + x)), one);
+        __m128i next;
+        if (R::conway) next = _mm_or_si128(_mm_cmpeq_epi8(n, three), _mm_and_si128(alive, _mm_cmpeq_epi8(n, two)));
+        else
+        {
+            next = _mm_setzero_si128();
+            for (int count = 0; count <= 8; count++)
+            {
+                bool born = (rule.birth >> count) & 1;
+                bool survives = (rule.survive >> count) & 1;
+                if (!born && !survives) continue;
+                __m128i match = _mm_cmpeq_epi8(n, _mm_set1_epi8((char)count));
+                if (!survives) match = _mm_andnot_si128(alive, match);
+                else if (!born) match = _mm_and_si128(alive, match);
+                next = _mm_or_si128(next, match);
+            }
+        }
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_and_si128(next, one));
+    }
+    return x;
+}
+
+template <typename R>
+SIMD_TARGET("avx2")
+int simdRowAVX2(const unsigned char* up, const unsigned char* cur, const unsigned char* down, unsigned char* dst, const R& rule)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i three = _mm256_set1_epi8(3);
+    int x = 1;
+    for (; x + 32 <= col_right; x += 32)
+    {
+        __m256i n = _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(up + x - 1)), _mm256_loadu_si256((const __m256i*)(up + x)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(up + x + 1)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(cur + x - 1)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(cur + x + 1)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(down + x - 1)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(down + x)));
+        n = _mm256_add_epi8(n, _mm256_loadu_si256((const __m256i*)(down + x + 1)));
+        __m256i alive = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(cur + x)), one);
+        __m256i next;
+        if (R::conway) next = _mm256_or_si256(_mm256_cmpeq_epi8(n, three), _mm256_and_si256(alive, _mm256_cmpeq_epi8(n, two)));
+        else
+        {
+            next = _mm256_setzero_si256();
+            for (int count = 0; count <= 8; count++)
+            {
+                bool born = (rule.birth >> count) & 1;
+                bool survives = (rule.survive >> count) & 1;
+                if (!born && !survives) continue;
+                __m256i match = _mm256_cmpeq_epi8(n, _mm256_set1_epi8((char)count));
+                if (!survives) match = _mm256_andnot_si256(alive, match);
+                else if (!born) match = _mm256_and_si256(alive, match);
+                next = _mm256_or_si256(next, match);
+            }
+        }
+        _mm256_storeu_si256((__m256i*)(dst + x), _mm256_and_si256(next, one));
+    }
+    return x;
+}
+
+template <typename R>
+SIMD_TARGET("avx512f,avx512bw")
+int simdRowAVX512(const unsigned char* up, const unsigned char* cur, const unsigned char* down, unsigned char* dst, const R& rule)
+{
+    const __m512i one = _mm512_set1_epi8(1);
+    const __m512i two = _mm512_set1_epi8(2);
+    const __m512i three = _mm512_set1_epi8(3);
+    int x = 1;
+    for (; x + 64 <= col_right; x += 64)
+    {
+        __m512i n = _mm512_add_epi8(_mm512_loadu_si512(up + x - 1), _mm512_loadu_si512(up + x));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(up + x + 1));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(cur + x - 1));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(cur + x + 1));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(down + x - 1));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(down + x));
+        n = _mm512_add_epi8(n, _mm512_loadu_si512(down + x + 1));
+        __mmask64 alive = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(cur + x), one);
+        __mmask64 next;
+        if (R::conway) next = _mm512_cmpeq_epi8_mask(n, three) | (alive & _mm512_cmpeq_epi8_mask(n, two));
+        else
+        {
+            next = 0;
+            for (int count = 0; count <= 8; count++)
+            {
+                bool born = (rule.birth >> count) & 1;
+                bool survives = (rule.survive >> count) & 1;
+                if (!born && !survives) continue;
+                __mmask64 match = _mm512_cmpeq_epi8_mask(n, _mm512_set1_epi8((char)count));
+                next |= born ? (survives ? match : (match & ~alive)) : (match & alive);
+            }
+        }
+        _mm512_storeu_si512(dst + x, _mm512_maskz_mov_epi8(next, one));
+    }
+    return x;
+}
+#endif
+
+template <typename R>
+void simdGeneration(const unsigned char* src, unsigned char* dst, SimdLevel level, const R& rule)
+{
+    int height = (int)h;
+    int row;
+#pragma omp parallel for schedule(static)
+    for (row = 0; row < height; row++)
+    {
+        const unsigned char* cur = src + row * w;
+        const unsigned char* up = src + ((row == 0) ? row_bot : row - 1) * w;
+        const unsigned char* down = src + ((row == row_bot) ? 0 : row + 1) * w;
+        unsigned char* out = dst + row * w;
+
+        int end = 1;
+#ifdef SIMD_X86
+        if (level == SIMD_AVX512) end = simdRowAVX512(up, cur, down, out, rule);
+        else if (level == SIMD_AVX2) end = simdRowAVX2(up, cur, down, out, rule);
+        else if (level == SIMD_SSE2) end = simdRowSSE2(up, cur, down, out, rule);
+#endif
+
+        // wrap column x == 0, the tail not filling a vector and x == col_right
+        ompCells(src, dst, row, 0, 1, rule);
+        ompCells(src, dst, row, end, (int)w, rule);
+    }
+}
+
+void runSIMD(const char* fileI, const char* fileO, unsigned int generations, int threads, const std::string& isa)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: simd" << std::endl;
+    if (isa != "auto" && isa != "scalar" && simdParse(isa) == SIMD_SCALAR)
+    {
+        std::cerr << "unknown --simd " << isa << ", possible values are auto, scalar, sse2, avx2 and avx512" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // init grid from file
+    Timing::getInstance()->startSetup();
+    if (!checkpointer.load(fileI, LAYOUT_BYTES, generations)) exit(EXIT_FAILURE);
+    if (!emitter.start(LAYOUT_BYTES, cells)) exit(EXIT_FAILURE);
+    cycles.start(LAYOUT_BYTES, true);
+
+    // make a second board to write the next generation into
+    oldCells = new unsigned char[total_elem_count];
+
+    if (threads != omp_get_num_threads()) omp_set_num_threads(threads);
+
+    // never use more than the cpu supports, even if forced
+    SimdLevel level = simdDetect();
+    if (isa != "auto" && simdParse(isa) < level) level = simdParse(isa);
+    if (debugOutput) std::cout << "number of processors: " << omp_get_num_procs() << ", set number of threads: " << threads << ", simd: " << simdName(level) << std::endl;
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    for (unsigned int gen = 0; gen < generations; gen++)
+    {
+        TIMING_SCOPE("generation");
+        withRule(rule, [&](auto r) { simdGeneration(cells, oldCells, level, r); });
+        std::swap(cells, oldCells);
+        checkpointer.after(gen + 1, cells);
+        emitter.after(gen + 1, cells);
+        gen += cycles.after(gen + 1, cells, generations);
+    }
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+
+    // write out result
+    Timing::getInstance()->startFinalization();
+    saveBoard(fileO, LAYOUT_BYTES);
+    checkpointer.finish();
+    emitter.finish();
+    Timing::getInstance()->stopFinalization();
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+/* ---------------------------------------------------------------------------
+sparse mode:
+only the live cells are stored, as a list of packed coordinates (y << 32 | x).
+each generation every live cell adds itself and its 8 neighbours (with the
+same wrap-around as the other modes) to an open addressing hash table with
+linear probing; a slot holds the coordinate and a byte of
+    bit 0       cell is alive
+    bits 1..    count of alive neighbours
+afterwards the table is scanned once and the cells matching the rule form the
+next list. the table is sized for 9 entries per live cell at a load of at most
+1/2, so it never grows during a generation and clearing it is proportional to
+the population as well. cost therefore scales with the live cells, not with
+w * h - only loading and saving touch the whole byte board.
+
+--mode auto loads the board, counts the live cells and runs sparse if the
+density is below SPARSE_DENSITY_THRESHOLD, otherwise the omp generation on
+the board that is already loaded.
+
+--------------------------------------------------------------------------- */
+
+#include "common.h"
+#include "ompMode.h" // ompGeneration for dense boards in auto mode
+#include "boardIO.h"
+
+#define SPARSE_DENSITY_THRESHOLD 0.02   // live cells / area below which sparse is faster than omp
+#define SPARSE_EMPTY ~0ULL
+
+struct SparseSlot
+{
+    uint64_t key;
+    uint64_t value;
+};
+
+class SparseTable
+{
+public:
+    // empties the table and makes room for at least entries keys
+    void reset(size_t entries)
+    {
+        size_t capacity = 64;
+        shift = 58;
+        while (capacity < entries * 2)
+        {
+            capacity <<= 1;
+            shift--;
+        }
+        if (slots.size() != capacity) slots.resize(capacity);
+        for (SparseSlot& slot : slots) slot.key = SPARSE_EMPTY;
+        mask = capacity - 1;
+    }
+
+    // value of key, inserted as 0 if not present yet
+    inline uint64_t& at(uint64_t key)
+    {
+        size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> shift);
+        while (slots[i].key != key)
+        {
+            if (slots[i].key == SPARSE_EMPTY)
+            {
+                slots[i].key = key;
+                slots[i].value = 0;
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        return slots[i].value;
+    }
+
+    std::vector<SparseSlot> slots;
+
+private:
+    size_t mask = 0;
+    unsigned int shift = 58;
+};
+
+inline uint64_t sparseKey(unsigned int x, unsigned int y)
+{
+    return ((uint64_t)y << 32) | x;
+}
+
+// calculates the next generation of live into next
+template <typename R>
+void sparseGeneration(const std::vector<uint64_t>& live, std::vector<uint64_t>& next, SparseTable& table, const R& rule)
+{
+    table.reset(live.size() * 9);
+    for (uint64_t key : live)
+    {
+        unsigned int x = (unsigned int)key;
+        unsigned int y = (unsigned int)(key >> 32);
+        unsigned int left = (x == 0) ? col_right : x - 1;
+        unsigned int right = ((int)x == col_right) ? 0 : x + 1;
+        unsigned int up = (y == 0) ? row_bot : y - 1;
+        unsigned int down = ((int)y == row_bot) ? 0 : y + 1;
+
+        table.at(key) |= STATE_ALIVE;
+        table.at(sparseKey(left, up)) += 2;
+        table.at(sparseKey(x, up)) += 2;
+        table.at(sparseKey(right, up)) += 2;
+        table.at(sparseKey(left, y)) += 2;
+        table.at(sparseKey(right, y)) += 2;
+        table.at(sparseKey(left, down)) += 2;
+        table.at(sparseKey(x, down)) += 2;
+        table.at(sparseKey(right, down)) += 2;
+    }
+
+    // conway: alive with 2 or 3 neighbours (5, 7), dead with 3 neighbours (6)
+    next.clear();
+    for (const SparseSlot& slot : table.slots)
+    {
+        if (slot.key != SPARSE_EMPTY && rule.next((unsigned char)(slot.value & STATE_ALIVE), (int)(slot.value >> 1))) next.push_back(slot.key);
+    }
+}
+
+// collects the live cells of the byte board, 8 cells per step over dead areas
+void sparseFromCells(std::vector<uint64_t>& live)
+{
+    live.clear();
+    for (unsigned int y = 0; y < h; y++)
+    {
+        const unsigned char* row = cells + (size_t)y * w;
+        unsigned int x = 0;
+        for (uint64_t word; x + 8 <= w; x += 8)
+        {
+            memcpy(&word, row + x, 8);
+            if (word == 0) continue;
+            for (unsigned int i = x; i < x + 8; i++)
+            {
+                if (row[i] & STATE_ALIVE) live.push_back(sparseKey(i, y));
+            }
+        }
+        for (; x < w; x++)
+        {
+            if (row[x] & STATE_ALIVE) live.push_back(sparseKey(x, y));
+        }
+    }
+}
+
+// writes the live cells back into the (cleared) byte board
+void sparseToCells(const std::vector<uint64_t>& live)
+{
+    memset(cells, 0, total_elem_count);
+    for (uint64_t key : live) cells[(size_t)(key >> 32) * w + (unsigned int)key] = STATE_ALIVE;
+}
+
+void runSparse(const char* fileI, const char* fileO, unsigned int generations, int threads, bool autoSelect = false)
+{
+#ifdef _DEBUG
+    if (debugOutput) std::cout << "DEBUG" << std::endl;
+#endif
+    if (debugOutput) std::cout << "running mode: " << (autoSelect ? "auto" : "sparse") << std::endl;
+
+    // init grid from file
+    Timing::getInstance()->startSetup();
+    if (!loadBoard(fileI, LAYOUT_BYTES)) exit(EXIT_FAILURE);
+
+    std::vector<uint64_t> live;
+    std::vector<uint64_t> next;
+    sparseFromCells(live);
+    double density = (double)live.size() / total_elem_count;
+    bool sparse = !autoSelect || density < SPARSE_DENSITY_THRESHOLD;
+    if (sparse && (rule.birth & 1))
+    {
+        // cells without live neighbours are never in the table
+        if (!autoSelect)
+        {
+            std::cerr << "sparse mode can not run rule " << ruleString(rule) << " (B0)" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        sparse = false;
+    }
+    if (debugOutput) std::cout << "population: " << live.size() << ", density: " << density << ", engine: " << (sparse ? "sparse" : "omp") << std::endl;
+
+    SparseTable table;
+    if (!sparse)
+    {
+        oldCells = new unsigned char[total_elem_count];
+        if (threads != omp_get_num_threads()) omp_set_num_threads(threads);
+    }
+    Timing::getInstance()->stopSetup();
+
+    Timing::getInstance()->startComputation();
+    for (unsigned int gen = 0; gen < generations; gen++)
+    {
+        TIMING_SCOPE("generation");
+        if (sparse)
+        {
+            withRule(rule, [&](auto r) { sparseGeneration(live, next, table, r); });
+            live.swap(next);
+        }
+        else
+        {
+            withRule(rule, [&](auto r) { ompGeneration(cells, oldCells, r); });
+            std::swap(cells, oldCells);
+        }
+    }
+    Timing::getInstance()->stopComputation();
+    board_generation += generations;
+    if (sparse) Timing::getInstance()->addValue("sparse population", (double)live.size());
+
+    // write out result
+    Timing::getInstance()->startFinalization();
+    if (sparse) sparseToCells(live);
+    saveBoard(fileO, LAYOUT_BYTES);
+    Timing::getInstance()->stopFinalization();
+}